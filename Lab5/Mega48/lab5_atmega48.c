@@ -13,39 +13,86 @@
 #include "mega48_uart_functions.h"
 #include "lm73_functions_skel.h"
 #include "twi_master.h"
+#include "remote_link.h"
 
-char temperature[2] = {'3', '5'};
 uint8_t status;
 extern uint8_t lm73_wr_buf[2];
 extern uint8_t lm73_rd_buf[2];
-uint16_t lm73_temp;
-char lm73_char_temp[8];
+volatile uint8_t lm73_status;
 
+link_rx_t link_rx;                  //frames from the mega128
+volatile uint8_t poll_pending = FALSE;
+volatile uint16_t uptime = 0;       //seconds since reset
+link_temp_t sample;                 //last LM73 reading
+link_temp_t sent;                   //last one pushed
+uint8_t tx_seq = 0;
 
+
+//a LINK_POLL from the mega128 asks for the temperature, sent from main
 ISR(USART_RX_vect) {
-    status = uart_getc();
-    if(status == 0xF0)
-        uart_puts(lm73_char_temp);
+    if(link_rx_byte(&link_rx, UDR0) && link_rx.type == LINK_POLL) { poll_pending = TRUE; }
+}
+
+//one second time base for the sample timestamps
+ISR(TIMER1_COMPA_vect) {
+    uptime++;
+}
+
+//sends the last sample as a LINK_TEMP frame
+void send_temp() {
+    uint8_t frame[sizeof(link_temp_t) + LINK_OVERHEAD];
+    uint8_t i, len;
+
+    len = link_frame(frame, LINK_TEMP, tx_seq++, &sample, sizeof(sample));
+    sent = sample;
+    sample.status &= ~LINK_ST_RESET; //only the first frame says so
+    for(i = 0; i < len; i++) { uart_putc(frame[i]); }
+}
+
+//TRUE if the sample is worth pushing: moved by more than LINK_PUSH_DELTA,
+//sensor came or went, or nothing sent for LINK_HEARTBEAT_SEC
+uint8_t push_due() {
+    int16_t moved = sample.temp - sent.temp;
+
+    if(sample.status & LINK_ST_RESET) { return(TRUE); }
+    if((sample.status ^ sent.status) & LINK_ST_SENSOR_OK) { return(TRUE); }
+    if(moved > LINK_PUSH_DELTA || moved < -LINK_PUSH_DELTA) { return(TRUE); }
+    return((uint16_t)(sample.time - sent.time) >= LINK_HEARTBEAT_SEC);
 }
 
 int main() {
+uint8_t i;
 
 init_twi();
 uart_init();
+//timer1 CTC, clk/1024, one compare match a second. Not free running, so
+//TWI_INSTRUMENT cannot be used on this node, see twi_master.h
+OCR1A = (F_CPU / 1024) - 1;
+TCCR1B = (1 << WGM12) | (1 << CS12) | (1 << CS10);
+TIMSK1 = (1 << OCIE1A);
 sei();
 
-lm73_wr_buf[0] = 0x00;
-twi_start_wr(LM73_ADDRESS, lm73_wr_buf, 2);
+lm73_wr_buf[0] = LM73_PTR_TEMP; //temp pointer, sent ahead of every read
+sample.status = LINK_ST_RESET;
 
 while(1) {
 
-twi_start_rd(LM73_ADDRESS, lm73_rd_buf, 2);
-_delay_ms(2);
-//format temperature array
-lm73_temp = (lm73_rd_buf[0] << 8) | (lm73_rd_buf[1]);
-lm73_temp = lm73_temp >> 7;
-itoa(lm73_temp, lm73_char_temp, 10);
-_delay_ms(500);
+twi_post(LM73_ADDRESS, lm73_wr_buf, 1, lm73_rd_buf, 2, &lm73_status); //polled, done on return
+cli();
+sample.time = uptime;
+sei();
+if(lm73_status & TWI_XFER_ERROR) { sample.status &= ~LINK_ST_SENSOR_OK; }
+else {
+    sample.temp = (int16_t)((lm73_rd_buf[0] << 8) | lm73_rd_buf[1]);
+    sample.status |= LINK_ST_SENSOR_OK;
+}
+
+//push it if it changed, answer polls while waiting for the next reading
+if(push_due()) { send_temp(); }
+for(i = 0; i < 50; i++) {
+    if(poll_pending) { poll_pending = FALSE; send_temp(); }
+    _delay_ms(10);
+}
 
 }
 }//main
@@ -7,11 +7,25 @@
 #include <avr/io.h>
 #include <stdlib.h>
 #include <avr/pgmspace.h>
+#include "uart_baud.h"
 
 //F_CPU is set in makefile, don't set it here.
 
-#define USART_BAUDRATE 9600  
-#define BAUDVALUE  ((F_CPU/(USART_BAUDRATE * 16UL)) - 1 )
+//Link to the mega128, must match its USART_BAUDRATE. Can be overridden in
+//DEFS. UBRR and U2X come from uart_baud.h.
+#ifndef USART_BAUDRATE
+#define USART_BAUDRATE 38400
+#endif
+
+#if BAUD_ERROR(USART_BAUDRATE) > BAUD_MAX_ERR
+#error "USART_BAUDRATE is more than 2% off at this F_CPU"
+#endif
+#if BAUD_UBRR(USART_BAUDRATE) > 4095
+#error "USART_BAUDRATE too low for this F_CPU"
+#endif
+
+#define BAUDVALUE  BAUD_UBRR(USART_BAUDRATE)
+#define BAUD_U2X   BAUD_USE_U2X(USART_BAUDRATE)
 
 #include <string.h>
 
@@ -69,6 +83,7 @@ void uart_init(){
 
 //async operation, no parity,  one stop bit, 8-bit characters
   UCSR0C |= (1<<UCSZ01) | (1<<UCSZ00);
+  if(BAUD_U2X){UCSR0A |= (1<<U2X0);}  //double speed if it gets closer
   UBRR0H = (BAUDVALUE >>8 ); //load upper byte of the baud rate into UBRR 
   UBRR0L =  BAUDVALUE;       //load lower byte of the baud rate into UBRR 
 
@@ -0,0 +1,77 @@
+//remote_link.c
+//Frame builder and receiver for the mega128 to Mega48 link. See
+//remote_link.h. The same file is used on both ends.
+
+#include <util/crc16.h>
+#include "remote_link.h"
+
+#define FALSE 0
+#define TRUE  1
+
+//receiver states
+enum link_rx_state{LINK_HUNT, LINK_LEN, LINK_TYPE, LINK_SEQ, LINK_DATA, LINK_CRC};
+
+//********************************************************************************
+//                            link_frame()
+//
+//Builds a frame into frame[], which must hold len + LINK_OVERHEAD bytes.
+//Returns the frame length.
+//
+uint8_t link_frame(uint8_t *frame, uint8_t type, uint8_t seq, const void *payload, uint8_t len){
+  const uint8_t *p = payload;
+  uint8_t crc, i;
+
+  frame[0] = LINK_SYNC;
+  frame[1] = len;
+  frame[2] = type;
+  frame[3] = seq;
+  for(i = 0; i < len; i++){frame[4 + i] = p[i];}
+  crc = 0;
+  for(i = 1; i < len + 4; i++){crc = _crc8_ccitt_update(crc, frame[i]);}
+  frame[len + 4] = crc;
+  return(len + LINK_OVERHEAD);
+}
+
+//********************************************************************************
+//                            link_rx_byte()
+//
+//Feeds one received byte to the receiver. Returns TRUE when it completes a
+//good frame, which is then in rx->type, rx->seq and rx->payload (rx->len
+//bytes) until the next call. Cheap enough for a receive ISR.
+//
+uint8_t link_rx_byte(link_rx_t *rx, uint8_t byte){
+  switch(rx->state){
+    case LINK_HUNT:
+      if(byte == LINK_SYNC){rx->state = LINK_LEN;}
+      return(FALSE);
+    case LINK_LEN:
+      if(byte > LINK_MAX){rx->len_errors++; rx->state = LINK_HUNT; return(FALSE);}
+      rx->len   = byte;
+      rx->crc   = _crc8_ccitt_update(0, byte);
+      rx->state = LINK_TYPE;
+      return(FALSE);
+    case LINK_TYPE:
+      rx->type  = byte;
+      rx->crc   = _crc8_ccitt_update(rx->crc, byte);
+      rx->state = LINK_SEQ;
+      return(FALSE);
+    case LINK_SEQ:
+      rx->seq   = byte;
+      rx->crc   = _crc8_ccitt_update(rx->crc, byte);
+      rx->idx   = 0;
+      rx->state = rx->len ? LINK_DATA : LINK_CRC;
+      return(FALSE);
+    case LINK_DATA:
+      rx->payload[rx->idx++] = byte;
+      rx->crc = _crc8_ccitt_update(rx->crc, byte);
+      if(rx->idx == rx->len){rx->state = LINK_CRC;}
+      return(FALSE);
+    case LINK_CRC:
+      rx->state = LINK_HUNT;
+      if(byte != rx->crc){rx->crc_errors++; return(FALSE);}
+      rx->frames++;
+      return(TRUE);
+  }//switch
+  rx->state = LINK_HUNT;
+  return(FALSE);
+}
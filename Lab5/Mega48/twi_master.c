@@ -2,32 +2,216 @@
 // R. Traylor
 // 11.07.2011
 // twi_master code   
+//
+// Transfers are posted into a small queue and run back to back by the ISR.
+// Posting never waits on the bus, so it is safe to do from other ISRs.
+// With NO_INTERRUPTS set the same queue is run by polling instead.
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 //#define F_CPU 16000000UL
 #include <util/twi.h>
+#include <util/delay.h>
 #include <stdlib.h>
+#include <string.h>
 #include "twi_master.h"
 
 #define ZERO  0x00
 #define ONE   0x01
 
+#define FALSE 0
+#define TRUE  1
+
 volatile uint8_t  *twi_buf;      //pointer to the buffer we are xferred from/to
 volatile uint8_t  twi_msg_size;  //number of bytes to be xferred
 volatile uint8_t  twi_bus_addr;  //address of device on TWI bus 
-volatile uint8_t  twi_state;     //status of transaction  
+volatile uint8_t  *twi_rd_buf;   //buffer read into after a repeated START
+volatile uint8_t  twi_rd_size;   //bytes left to read after the write, if any
+volatile uint8_t  twi_state;     //TWSR of the last failed transaction, 0 if none
+
+static twi_xfer_t       twi_queue[TWI_QUEUE_SIZE]; //posted transfers
+static volatile uint8_t twi_q_head;  //next free slot, advanced by twi_post()
+static volatile uint8_t twi_q_tail;  //xfer on the bus, advanced by the ISR
+
+static volatile uint8_t twi_tries;   //retries used by the xfer on the bus
+static volatile uint8_t twi_timer;   //ticks since the bus last made progress
+static volatile uint8_t twi_rec_edge; //SCL/SDA edges left in a bus recovery, 0 if none
+static twi_stats_t      twi_stats;   //fault counters
+
+#if TWI_INSTRUMENT
+static twi_instr_t twi_instr[TWI_INSTR_DEVICES]; //per device latency stats
+static uint16_t    twi_ts_start;                 //when the last START went out
+static uint16_t    twi_ts_last;                  //when the bus last moved
+static uint16_t    twi_gap_max;                  //longest gap in this xfer
+static uint8_t     twi_xfer_bytes;               //data bytes in this xfer
+
+//****************************************************************************
+//Stamps the START of a transfer.
+//****************************************************************************
+static void twi_instr_start(void){
+  twi_ts_start   = TWI_TIMESTAMP();
+  twi_ts_last    = twi_ts_start;
+  twi_gap_max    = 0;
+  twi_xfer_bytes = 0;
+}
+
+//****************************************************************************
+//Timer ticks from then to now, across at most one wrap of the timer at TOP.
+//****************************************************************************
+static uint16_t twi_ts_diff(uint16_t now, uint16_t then){
+  if(now >= then){return(now - then);}
+  return(now + (TWI_TS_TOP + 1) - then);
+}
+
+//****************************************************************************
+//Stamps a byte moved on the bus, keeping the longest gap between events.
+//****************************************************************************
+static void twi_instr_byte(void){
+  uint16_t now = TWI_TIMESTAMP();
+  uint16_t gap = twi_ts_diff(now, twi_ts_last);
+
+  if(gap > twi_gap_max){twi_gap_max = gap;}
+  twi_ts_last = now;
+  twi_xfer_bytes++;
+}
+
+//****************************************************************************
+//Stamps the STOP and folds the transfer into its device's stats. Devices
+//past the first TWI_INSTR_DEVICES seen are not tracked.
+//****************************************************************************
+static void twi_instr_stop(uint8_t addr, uint8_t result){
+  uint16_t    lat = twi_ts_diff(TWI_TIMESTAMP(), twi_ts_start);
+  twi_instr_t *dev;
+  uint8_t     i;
+
+  addr &= ~TW_READ;
+  for(i = 0; i < TWI_INSTR_DEVICES; i++){
+    dev = &twi_instr[i];
+    if(dev->addr == 0){dev->addr = addr; dev->lat_min = 0xFFFF;}
+    if(dev->addr == addr){break;}
+  }
+  if(i == TWI_INSTR_DEVICES){return;}
+
+  dev->count++;
+  if(result & TWI_XFER_ERROR){dev->errors++;}
+  if(lat < dev->lat_min){dev->lat_min = lat;}
+  if(lat > dev->lat_max){dev->lat_max = lat;}
+  dev->lat_sum += lat;
+  dev->bytes   += twi_xfer_bytes;
+  if(twi_gap_max > dev->gap_max){dev->gap_max = twi_gap_max;}
+}
+
+#define TWI_INSTR_START()             twi_instr_start()
+#define TWI_INSTR_BYTE()              twi_instr_byte()
+#define TWI_INSTR_STOP(addr, result)  twi_instr_stop(addr, result)
+#else
+#define TWI_INSTR_START()
+#define TWI_INSTR_BYTE()
+#define TWI_INSTR_STOP(addr, result)
+#endif
+
+//****************************************************************************
+//Loads the transfer at the tail of the queue into the variables the ISR
+//works from. Also used to start a failed transfer over from the beginning.
+//****************************************************************************
+static void twi_rewind(void){
+  twi_xfer_t *xfer = &twi_queue[twi_q_tail];
+
+  twi_bus_addr = xfer->addr;
+  twi_buf      = xfer->buf;
+  twi_msg_size = xfer->cnt;
+  twi_rd_buf   = xfer->rd_buf;
+  twi_rd_size  = xfer->rd_cnt;
+  twi_timer    = 0;
+}
+
+//****************************************************************************
+//Loads a new transfer, with a fresh set of retries.
+//****************************************************************************
+static void twi_load(void){
+  twi_tries = 0;
+  twi_rewind();
+}
+
+//****************************************************************************
+//Retires the transfer on the bus and hands its result (TWI_XFER_DONE, plus
+//TWI_XFER_ERROR if it failed) to the caller's status byte. Returns the TWCR
+//value that ends it: a plain STOP if the queue is now empty, otherwise STOP
+//followed by START for the next transfer, which is loaded here.
+//****************************************************************************
+static uint8_t twi_retire(uint8_t result){
+  twi_xfer_t *xfer = &twi_queue[twi_q_tail];
 
+  TWI_INSTR_STOP(xfer->addr, result);
+  if(xfer->status){*(xfer->status) = result;}
+  twi_q_tail = (twi_q_tail + 1) & (TWI_QUEUE_SIZE - 1);
+  if(twi_q_tail == twi_q_head){return(TWCR_STOP);} //nothing left, go idle
+  twi_load();
+  return(TWCR_STOP_START);
+}
+
+//****************************************************************************
+//Gives up on the transfer on the bus after its retries ran out. Returns the
+//TWCR value to end it with, as twi_retire() does.
+//****************************************************************************
+static uint8_t twi_give_up(void){
+  twi_stats.failed++;
+  return(twi_retire(TWI_XFER_DONE | TWI_XFER_ERROR));
+}
+
+//****************************************************************************
+//Frees a hung bus. A slave left holding SDA low in the middle of a byte is
+//clocked with 9 pulses on SCL so it can finish and let go, then a STOP is
+//sent by hand. The lines are open drain, driven low through DDR only and
+//pulled high by the board resistors. twi_recover_begin() takes the pins
+//from the TWI, then each twi_recover_edge() call moves one line, so the
+//recovery can be spread over timer ticks instead of waited out in an ISR.
 //****************************************************************************
-//This is the TWI ISR. Different actions are taken depending upon the value
-//of the TWI status register TWSR.
+static void twi_recover_begin(void){
+  TWCR = 0;                                             //hand pins back to the port
+  TWI_PORT &= ~((1<<TWI_SCL_BIT) | (1<<TWI_SDA_BIT));   //low when driven
+  TWI_DDR  &= ~((1<<TWI_SCL_BIT) | (1<<TWI_SDA_BIT));   //release both lines
+  twi_rec_edge = TWI_RECOVER_EDGES;
+}
+
+//****************************************************************************
+//Drives the next edge of a recovery. Returns TRUE when the STOP is out and
+//the TWI has been set up again.
+//****************************************************************************
+static uint8_t twi_recover_edge(void){
+  uint8_t edge = --twi_rec_edge;
+
+  if(edge >= 4){                                        //9 clocks on SCL
+    if(edge & 1){TWI_DDR |=  (1<<TWI_SCL_BIT);}         //SCL low
+    else        {TWI_DDR &= ~(1<<TWI_SCL_BIT);}         //SCL high
+    return(FALSE);
+  }
+  switch(edge){                                         //STOP, SDA rises while SCL high
+    case 3: TWI_DDR |=  (1<<TWI_SCL_BIT); return(FALSE);
+    case 2: TWI_DDR |=  (1<<TWI_SDA_BIT); return(FALSE);
+    case 1: TWI_DDR &= ~(1<<TWI_SCL_BIT); return(FALSE);
+  }
+  TWI_DDR &= ~(1<<TWI_SDA_BIT);
+  twi_stats.recoveries++;
+  init_twi();
+  return(TRUE);
+}
+
+//****************************************************************************
+//Moves the transfer on the bus one step. Different actions are taken
+//depending upon the value of the TWI status register TWSR. This is the body
+//of the TWI ISR, and is also run by twi_run() when polling. Inlined into
+//both so the ISR does not pay for a call.
 //****************************************************************************/
-ISR(TWI_vect){
+static inline __attribute__((always_inline)) void twi_service(void){
   static uint8_t twi_buf_ptr;  //index into the buffer being used 
 
+  twi_timer = 0;               //bus is moving, restart the hang timeout
   switch (TWSR) {
     case TW_START:          //START has been xmitted, fall thorough
+      TWI_INSTR_START();
     case TW_REP_START:      //Repeated START was xmitted
       TWDR = twi_bus_addr;  //load up the twi bus address
       twi_buf_ptr = 0;      //initalize buffer pointer 
@@ -35,66 +219,268 @@ ISR(TWI_vect){
       break;
     case TW_MT_SLA_ACK:     //SLA+W was xmitted and ACK rcvd, fall through 
     case TW_MT_DATA_ACK:                //Data byte was xmitted and ACK rcvd
+      TWI_INSTR_BYTE();                 //counts SLA+W too, as the first byte
       if (twi_buf_ptr < twi_msg_size){  //send data till done
         TWDR = twi_buf[twi_buf_ptr++];  //load next and postincrement index
         TWCR = TWCR_SEND;               //send next byte 
       }
-      else{TWCR = TWCR_STOP;}           //last byte sent, send STOP 
+      else if (twi_rd_size){            //write done, turn the bus around
+        twi_bus_addr |= TW_READ;        //same device, now SLA+R
+        twi_buf = twi_rd_buf;
+        twi_msg_size = twi_rd_size;
+        twi_rd_size = 0;
+        TWCR = TWCR_START;              //repeated START, we keep the bus
+      }
+      else{TWCR = twi_retire(TWI_XFER_DONE);} //last byte sent, STOP or chain next
       break;
     case TW_MR_DATA_ACK:                //Data byte has been rcvd, ACK xmitted, fall through
       twi_buf[twi_buf_ptr++] = TWDR;    //fill buffer with rcvd data
     case TW_MR_SLA_ACK:                 //SLA+R xmitted and ACK rcvd
+      TWI_INSTR_BYTE();
       if (twi_buf_ptr < (twi_msg_size-1)){TWCR = TWCR_RACK;}  //ACK each byte
       else                               {TWCR = TWCR_RNACK;} //NACK last byte 
-      break; 
+      break;
     case TW_MR_DATA_NACK: //Data byte was rcvd and NACK xmitted
       twi_buf[twi_buf_ptr] = TWDR;      //save last byte to buffer
-      TWCR = TWCR_STOP;                 //initiate a STOP
-      break;      
+      TWI_INSTR_BYTE();
+      TWCR = twi_retire(TWI_XFER_DONE); //STOP or chain next
+      break;
     case TW_MT_ARB_LOST:                //Arbitration lost 
-      TWCR = TWCR_START;                //initiate RESTART 
+      twi_stats.arb_lost++;
+      if(twi_tries++ < TWI_MAX_RETRIES){twi_rewind(); TWCR = TWCR_START;} //initiate RESTART 
+      else                             {TWCR = twi_give_up();}
       break;
     default:                            //Error occured, save TWSR 
       twi_state = TWSR;         
-      TWCR = TWCR_RST;                  //Reset TWI, disable interupts 
+      if((twi_state == TW_MT_SLA_NACK) || (twi_state == TW_MT_DATA_NACK) ||
+         (twi_state == TW_MR_SLA_NACK)){twi_stats.nacks++;}
+      //release the bus with a STOP, then try the xfer again or drop it
+      if(twi_tries++ < TWI_MAX_RETRIES){twi_rewind(); TWCR = TWCR_STOP_START;}
+      else                             {TWCR = twi_give_up();}
   }//switch
-}//TWI_isr
+}//twi_service
+//****************************************************************************
+
+//****************************************************************************
+//Handles a transfer that has stopped moving: stops the TWI and starts a bus
+//recovery. The transfer is picked up again by twi_recovered().
+//****************************************************************************
+static void twi_timeout(void){
+  twi_stats.timeouts++;
+  twi_state = TWSR;
+  twi_recover_begin();
+}
+
+//****************************************************************************
+//Once the bus is free again, retries the transfer that hung, or drops it if
+//out of retries and goes on to the next one.
+//****************************************************************************
+static void twi_recovered(void){
+  if(twi_tries++ < TWI_MAX_RETRIES){twi_rewind(); TWCR = TWCR_START;}
+  else if(twi_give_up() != TWCR_STOP){TWCR = TWCR_START;} //on to the next one
+}
+
+//****************************************************************************
+//Runs the queue until it is empty by polling TWINT. A transfer that does
+//not move for TWI_POLL_TIMEOUT polls is timed out, and the bus recovered
+//right here at about 100khz, since the caller is waiting anyway.
+//****************************************************************************
+static void twi_run(void){
+  uint16_t polls = 0;
+
+  while(twi_q_head != twi_q_tail){
+    if(TWCR & (1<<TWINT)){twi_service(); polls = 0;}
+    else if(++polls == TWI_POLL_TIMEOUT){
+      twi_timeout();
+      while(!twi_recover_edge()){_delay_us(5);}
+      twi_recovered();
+      polls = 0;
+    }
+  }
+}
+
+#if !(NO_INTERRUPTS)
+//****************************************************************************
+//This is the TWI ISR.
+//****************************************************************************
+ISR(TWI_vect){
+  twi_service();
+}
+#endif
 //****************************************************************************
 
 //*****************************************************************************
-//Call this function to test if the TWI unit is busy transferring data. The TWI
-//code uses the the interrupt enable bit (TWIE) to indicate if the TWI unit
-//is busy or not.  This protocol must be maintained for correct operation.
+//Call this function to test if the TWI unit is busy transferring data. The
+//TWI is busy for as long as there are transfers left in the queue, including
+//the one on the bus.
 //*****************************************************************************
 uint8_t twi_busy(void){
-  return (bit_is_set(TWCR,TWIE)); //if interrupt is enabled, twi is busy
+  return (twi_q_head != twi_q_tail); //anything still queued, twi is busy
+}
+//*****************************************************************************
+
+//*****************************************************************************
+//Returns the TWSR value saved when the last transfer failed, or zero if none
+//has failed since the previous call. Reading it clears it.
+//*****************************************************************************
+uint8_t twi_error(void){
+  uint8_t err;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    err = twi_state;
+    twi_state = 0;
+  }
+  return(err);
+}
+//*****************************************************************************
+
+//*****************************************************************************
+//Call this from a periodic timer interrupt. If the transfer on the bus has
+//not moved for TWI_TIMEOUT_TICKS calls, the TWI is stopped and the bus is
+//recovered, one SCL/SDA edge per call, after which the transfer is retried,
+//or dropped if out of retries. The polled driver times and recovers its
+//own transfers, so there it does nothing.
+//*****************************************************************************
+void twi_tick(void){
+#if !(NO_INTERRUPTS)
+  if(twi_rec_edge){                                    //recovering, next edge
+    if(twi_recover_edge()){twi_recovered();}
+    return;
+  }
+  if(twi_q_head == twi_q_tail){twi_timer = 0; return;} //idle, nothing to time
+  if(++twi_timer < TWI_TIMEOUT_TICKS){return;}
+  twi_timeout();
+#endif
+}
+//*****************************************************************************
+
+//*****************************************************************************
+//Runs everything queued to completion by polling, then returns. For the
+//interrupt driver before sei() at boot, or anywhere interrupts are off;
+//it must not be called while the TWI ISR can run. The polled driver has
+//nothing queued by the time twi_post() returns, so there it is a no-op.
+//*****************************************************************************
+void twi_flush(void){
+  twi_run();
 }
 //*****************************************************************************
 
+//*****************************************************************************
+//Copies out the fault counters.
+//*****************************************************************************
+void twi_get_stats(twi_stats_t *stats){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    *stats = twi_stats;
+  }
+}
+//*****************************************************************************
+
+#if TWI_INSTRUMENT
+//*****************************************************************************
+//Writes the per device latency stats out through put_str, e.g. uart1_puts,
+//one line per device with times in microseconds.
+//*****************************************************************************
+void twi_instr_dump(void (*put_str)(char *str)){
+  twi_instr_t dev;
+  char        str[12];
+  uint8_t     i;
+
+  for(i = 0; i < TWI_INSTR_DEVICES; i++){
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){dev = twi_instr[i];}
+    if(dev.addr == 0 || dev.count == 0){continue;}
+    put_str("TWI 0x");  utoa(dev.addr, str, 16);                                put_str(str);
+    put_str(" n:");     utoa(dev.count, str, 10);                               put_str(str);
+    put_str(" us min:");utoa(dev.lat_min / TWI_TS_PER_US, str, 10);             put_str(str);
+    put_str(" avg:");   ultoa(dev.lat_sum / dev.count / TWI_TS_PER_US, str, 10); put_str(str);
+    put_str(" max:");   utoa(dev.lat_max / TWI_TS_PER_US, str, 10);             put_str(str);
+    put_str(" gap:");   utoa(dev.gap_max / TWI_TS_PER_US, str, 10);             put_str(str);
+    put_str(" bytes:"); ultoa(dev.bytes, str, 10);                              put_str(str);
+    put_str(" err:");   utoa(dev.errors, str, 10);                              put_str(str);
+    put_str("\n\r");
+  }
+}
+
+//*****************************************************************************
+//Clears the latency stats.
+//*****************************************************************************
+void twi_instr_reset(void){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    memset(twi_instr, 0, sizeof(twi_instr));
+  }
+}
+//*****************************************************************************
+#endif
+
 //****************************************************************************
-//Initiates a write transfer. Loads global variables. Sends START. ISR handles
-//the rest.
+//Queues a transfer and returns at once. The address must already carry the
+//R/W bit. A write with rd_cnt non-zero turns into a read of rd_cnt bytes
+//after a repeated START. If the TWI is idle the START is sent here,
+//otherwise the ISR will get to it after the transfers ahead of it. The
+//buffers must stay untouched until *status shows TWI_XFER_DONE. Returns
+//FALSE, without waiting, if the queue is full.
+//The polled driver runs the transfer here and returns when it is done.
 //****************************************************************************
-void twi_start_wr(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt){
+uint8_t twi_post(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt,
+                 uint8_t *rd_data, uint8_t rd_cnt, volatile uint8_t *status){
+  uint8_t    next;
+  twi_xfer_t *xfer;
 
-  while(twi_busy());                    //wait till TWI rdy for next xfer
-  twi_bus_addr = (twi_addr & ~TW_READ); //set twi bus address, mark as write 
-  twi_buf = twi_data;                   //load pointer to write buffer
-  twi_msg_size = byte_cnt;              //load size of xfer 
-  TWCR = TWCR_START;                    //initiate START
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    next = (twi_q_head + 1) & (TWI_QUEUE_SIZE - 1);
+    if(next == twi_q_tail){return(FALSE);}  //queue full, drop it
+    if(status){*status = TWI_XFER_PENDING;}
+    xfer = &twi_queue[twi_q_head];
+    xfer->addr = twi_addr;
+    xfer->buf  = twi_data;
+    xfer->cnt  = byte_cnt;
+    xfer->rd_buf = rd_data;
+    xfer->rd_cnt = rd_cnt;
+    xfer->status = status;
+    if(twi_q_head == twi_q_tail){           //TWI idle, kick it off
+      twi_q_head = next;
+      twi_load();
+      TWCR = TWCR_START;                    //initiate START
+    }
+    else{twi_q_head = next;}                //ISR will chain to it
+  }
+#if (NO_INTERRUPTS)
+  twi_run();                                //polled, see it through here
+#endif
+  return(TRUE);
+}
+
+//****************************************************************************
+//Initiates a write transfer. Queues it and returns, ISR handles the rest.
+//****************************************************************************
+uint8_t twi_start_wr(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt){
+  return(twi_post((twi_addr & ~TW_READ), twi_data, byte_cnt, NULL, 0, NULL)); //mark as write
 }
 
 //****************************************************************************
-//Initiates a read transfer. Loads global variables. Sends START. ISR handles
-//the rest.
+//Initiates a read transfer. Queues it and returns, ISR handles the rest.
 //****************************************************************************
-void twi_start_rd(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt){
+uint8_t twi_start_rd(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt){
+  return(twi_post((twi_addr | TW_READ), twi_data, byte_cnt, NULL, 0, NULL)); //mark as read
+}
 
-  while(twi_busy());                   //wait till TWI rdy for next xfer
-  twi_bus_addr = (twi_addr | TW_READ); //set twi bus address, mark as read  
-  twi_buf = twi_data;                  //load pointer to write buffer
-  twi_msg_size = byte_cnt;             //load size of xfer 
-  TWCR = TWCR_START;                   //initiate START
+//****************************************************************************
+//Initiates a combined transfer for register style devices: writes wr_cnt
+//bytes (a register pointer or a command), then a repeated START and a read
+//of rd_cnt bytes, all in one bus ownership with a single STOP at the end.
+//
+//Bus time for one LM73 temperature read at 400khz (2.5us/bit, 9 bits/byte):
+//  two xfers : S SLA+W PTR P  tBUF  S SLA+R D0 D1 P   5 bytes 112.5us
+//                                                     +STOP+tBUF+START ~2.5us
+//                                                     +ISR turnaround, re-arbitration
+//  one xfer  : S SLA+W PTR Sr SLA+R D0 D1 P           5 bytes 112.5us
+//                                                     +Sr ~1.2us
+//The bytes on the wire are the same; what goes away is one STOP, the bus
+//free time, the second arbitration and the software gap between the two
+//xfers. For the Si4734 that gap was a blind 300us _delay_us().
+//****************************************************************************
+uint8_t twi_start_wr_rd(uint8_t twi_addr, uint8_t *wr_data, uint8_t wr_cnt,
+                        uint8_t *rd_data, uint8_t rd_cnt){
+  return(twi_post((twi_addr & ~TW_READ), wr_data, wr_cnt, rd_data, rd_cnt, NULL));
 }
 //******************************************************************************
 //                            init_twi                               
@@ -108,5 +494,4 @@ void init_twi(){
   TWDR = 0xFF;     //release SDA, default contents
   TWSR = 0x00;     //prescaler value = 1
   TWBR = TWI_TWBR; //defined in twi_master.h 
-} 
-
+}
@@ -135,7 +135,10 @@ uint8_t remote_byte = 1;
 
 char mode_text[16] = "Normal Mode     ";
 char temp_text[16] = "In:   C Out:   C";
-char lcd_display[32];
+char lcd_display[LCD_CELLS];
+#if LCD_COLS != 16 || LCD_ROWS != 2
+#error "the lab5 screens are laid out for a 2x16 LCD"
+#endif
 
 //holds data to be sent to the segments. logic zero turns segment on
 uint8_t segment_data[5];
@@ -0,0 +1,93 @@
+//console.c
+//UART1 command console. See console.h.
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "uart_functions.h"
+#include "log.h"
+#include "console.h"
+
+#define FALSE 0
+#define TRUE  1
+
+static char    console_line[CONSOLE_LINE];
+static uint8_t console_len;
+static uint8_t console_overflow;  //line ran past CONSOLE_LINE, drop it at the end
+
+//********************************************************************************
+//                            console_uint()
+//
+//Decimal, or hex with a 0x in front. FALSE for anything else or more than
+//16 bits.
+//
+uint8_t console_uint(const char *s, uint16_t *val){
+  uint32_t v = 0;
+  uint8_t  base = 10, d;
+
+  if(s[0] == '0' && (s[1] == 'x' || s[1] == 'X')){base = 16; s += 2;}
+  if(*s == '\0'){return(FALSE);}
+  for(; *s; s++){
+    if(*s >= '0' && *s <= '9'){d = *s - '0';}
+    else if(base == 16 && (*s | 0x20) >= 'a' && (*s | 0x20) <= 'f'){d = (*s | 0x20) - 'a' + 10;}
+    else{return(FALSE);}
+    v = v * base + d;
+    if(v > 0xFFFF){return(FALSE);}
+  }
+  *val = v;
+  return(TRUE);
+}
+
+//********************************************************************************
+//                            console_run()
+//
+//Splits the line into words in place and runs the command.
+//
+static void console_run(const console_cmd_t *cmds, uint8_t n){
+  char    *argv[CONSOLE_ARGS];
+  uint8_t argc = 0;
+  uint8_t i;
+  void    (*fn)(uint8_t, char **);
+
+  for(i = 0; i < console_len; i++){
+    if(console_line[i] == ' ' || console_line[i] == '\t'){console_line[i] = '\0'; continue;}
+    if(i > 0 && console_line[i - 1] != '\0'){continue;} //inside a word
+    if(argc == CONSOLE_ARGS){LOG("console: too many words"); return;}
+    argv[argc++] = &console_line[i];
+  }
+  console_line[console_len] = '\0';
+  if(argc == 0){return;}  //blank line, or the LF of a CR LF
+
+  for(i = 0; i < n; i++){
+    if(strcmp_P(argv[0], cmds[i].name) == 0){
+      fn = (void (*)(uint8_t, char **))pgm_read_ptr(&cmds[i].fn);
+      fn(argc, argv);
+      return;
+    }
+  }
+  LOG("console: unknown command, try help");
+}
+
+//********************************************************************************
+//                            console_service()
+//
+//Takes up to CONSOLE_CHARS bytes from UART1 and runs at most one command,
+//so a pass costs one command at most, whatever is waiting.
+//
+void console_service(const console_cmd_t *cmds, uint8_t n){
+  uint8_t i;
+  char    c;
+
+  for(i = 0; i < CONSOLE_CHARS; i++){
+    if(!uart1_read(&c, 1)){return;}
+    if(c == '\r' || c == '\n'){
+      if(console_overflow){LOG("console: line too long");}
+      else{console_run(cmds, n);}
+      console_len = 0;
+      console_overflow = FALSE;
+      return;
+    }
+    if(c == '\b' || c == 0x7F){if(console_len){console_len--;} continue;}
+    if(console_len == CONSOLE_LINE - 1){console_overflow = TRUE; continue;} //room for the NUL
+    console_line[console_len++] = c;
+  }
+}
@@ -0,0 +1,30 @@
+//console.h
+//Line oriented command console on UART1.
+//
+//console_service() is called every pass of the main loop. It takes at most
+//CONSOLE_CHARS bytes from the UART1 receive ring and returns, so a burst of
+//typing never holds up the clock or the display. A line ends at CR or LF.
+//It is split in place into at most CONSOLE_ARGS words, and the first word
+//is looked up in a command table kept in flash. Nothing is allocated.
+//Replies are up to the commands, see log.h.
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+
+#define CONSOLE_LINE   32  //longest line, longer ones are thrown away
+#define CONSOLE_ARGS   4   //words in a line, command included
+#define CONSOLE_CHARS  8   //bytes taken per console_service() call
+#define CONSOLE_NAME   8   //command name, NUL included
+
+//a command table entry, the table goes in PROGMEM
+typedef struct {
+  char name[CONSOLE_NAME];
+  void (*fn)(uint8_t argc, char **argv);  //argv[0] is the command
+} console_cmd_t;
+
+void    console_service(const console_cmd_t *cmds, uint8_t n);
+uint8_t console_uint(const char *s, uint16_t *val);  //TRUE if s is a number
+
+#endif //CONSOLE_H
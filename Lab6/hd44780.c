@@ -1,8 +1,9 @@
 //hd44780.c
 //A set of useful functions for writing LCD characer displays
 //that utilize the Hitachi HD44780 or equivalent LCD controller.
-//This code also includes adaptation for 4 bit LCD interface.
-//Right now support only exists or 2x16 displays.
+//The interface (SPI or 4-bit), timing and display size are chosen at
+//compile time, see hd44780.h. Lab5 and the Debounce, other, Temperature
+//and UART lecture examples build it from here rather than keep a copy.
 
 
 //Original source by R. Traylor ~2006
@@ -13,43 +14,71 @@
 
 #include <avr/io.h>
 #include <util/delay.h>
+#include <util/atomic.h>
 #include <string.h>
 #include <stdlib.h>
 #include "hd44780.h"
 
-#define NUM_LCD_CHARS 16
-
-//If using an interrupt driven, one char at a time style lcd refresh
-//for a 2x16 display, use this array to place anything to be displayed
-char lcd_string_array[32];  //holds two strings to refresh the LCD
-
-char  lcd_str[16];  //holds string to send to lcd  
+//what refresh_lcd() has put on the LCD, and the cell index the LCD address
+//counter points at. A queued clear sets both to match the cleared LCD.
+#define LCD_CURSOR_UNKNOWN 0xFF
+static char    lcd_shadow[LCD_CELLS];
+static uint8_t lcd_cursor = LCD_CURSOR_UNKNOWN;
+static uint8_t lcd_cell = 0;   //where the search for a changed cell starts
+
+static volatile uint16_t lcd_bytes;  //bytes sent to the LCD, see lcd_get_bytes()
+
+//execution times, the LCD takes nothing else until they are over
+#define LCD_CMD_US     40    //most commands and characters, 37us
+#define LCD_HOME_US    1500  //return home
+#define LCD_CLEAR_US   1800  //clear display
+
+//function set: 4 or 8 bit interface, one or two line mode
+#define LCD_FUNCTION_SET (0x20 | ((LCD_TRANSPORT==LCD_SPI) ? 0x10 : 0) | ((LCD_ROWS > 1) ? 0x08 : 0))
+
+//lcd_q_t flags
+#define LCD_Q_CHAR     0x01  //RS high, byte is a character
+#define LCD_Q_NIBBLE   0x02  //4-bit mode init, byte goes out as is in one strobe
+#define LCD_Q_DELAY    0x04  //nothing is sent, only the wait
+#define LCD_Q_CLEARED  0x08  //the command clears the LCD, reset the shadow
+#define LCD_Q_TIMED    0x10  //wait the full time, the busy flag isn't valid yet
+
+typedef struct {
+  uint8_t  flags;  //LCD_Q_*
+  uint8_t  byte;
+  uint16_t wait;   //us before the LCD takes the next byte
+} lcd_q_t;
+
+//commands waiting to be sent, filled from main by the functions below and
+//emptied by refresh_lcd() from the timer ISR
+static lcd_q_t           lcd_q[LCD_QUEUE];
+static volatile uint8_t  lcd_q_head;
+static volatile uint8_t  lcd_q_tail;
+static volatile uint16_t lcd_q_dropped;  //queue full
+static uint16_t          lcd_wait;       //us left of the last command sent
+#if LCD_TIMING==LCD_BUSY_FLAG
+static uint8_t           lcd_timed = LCD_Q_TIMED; //last command was LCD_Q_TIMED, so before init too
+#endif
 
 //-----------------------------------------------------------------------------
-//                               send_lcd
-//
-// Sends a command or character data to the lcd. First argument of 0x00 indicates 
-// a command transfer while 0x01 indicates data transfer.  The next byte is the 
-// command or character byte. 
+//                               lcd_write
 //
-// This is a low-level function usually called by the other functions but may
-// be called directly to provide more control. Most commonly controlled
-// commands require 37us to complete. Thus, this routine should be called no more
-// often than every 37us.
+// Puts one byte on the LCD interface. Only refresh_lcd() calls this, so the
+// LCD is never written faster than it can take.
 //
-// Commnads that require more time have delays built in for them.
-//
-void send_lcd(uint8_t cmd_or_char, uint8_t byte){
+static void lcd_write(uint8_t flags, uint8_t byte){
 
-#if SPI_MODE==1
-  SPDR = (cmd_or_char)? 0x01 : 0x00;  //send the proper value for intent
+  lcd_bytes++;
+#if LCD_TRANSPORT==LCD_SPI
+  SPDR = (flags & LCD_Q_CHAR)? 0x01 : 0x00;  //send the proper value for intent
   while (bit_is_clear(SPSR,SPIF)){}   //wait till byte is sent out
   SPDR = byte;                        //send payload
   while (bit_is_clear(SPSR,SPIF)){}   //wait till byte is sent out
   strobe_lcd();                       //strobe the LCD enable pin
 #else //4-bit mode
-  if(cmd_or_char==0x01){LCD_PORT |=  (1<<LCD_CMD_DATA_BIT);}
-  else                 {LCD_PORT &= ~(1<<LCD_CMD_DATA_BIT);} 
+  if(flags & LCD_Q_NIBBLE){LCD_PORT = byte; strobe_lcd(); return;} //8-bit init writes
+  if(flags & LCD_Q_CHAR){LCD_PORT |=  (1<<LCD_CMD_DATA_BIT);}
+  else                  {LCD_PORT &= ~(1<<LCD_CMD_DATA_BIT);} 
   uint8_t temp = LCD_PORT & 0x0F;             //perserve lower nibble, clear top nibble
   LCD_PORT   = temp | (byte & 0xF0);  //output upper nibble first
   strobe_lcd();                       //send to LCD
@@ -58,21 +87,139 @@ void send_lcd(uint8_t cmd_or_char, uint8_t byte){
 #endif
 }
 
+#if LCD_TIMING==LCD_BUSY_FLAG
+//-----------------------------------------------------------------------------
+//                               lcd_ready
+//
+// Reads the busy flag, up to LCD_BF_TRIES times. TRUE as soon as it reads
+// clear, FALSE if the LCD is still busy after that.
+//
+static uint8_t lcd_ready(void){
+  uint8_t tries, bf = 0x80;
+
+  LCD_PORT_DDR &= 0x0F;                          //data lines in
+  LCD_PORT &= ~(0xF0 | (1<<LCD_CMD_DATA_BIT));   //no pull ups, RS low
+  LCD_PORT |= (1<<LCD_RDWR_BIT);                 //read
+  for(tries = 0; tries < LCD_BF_TRIES && bf; tries++){
+    LCD_PORT |= (1<<LCD_STROBE_BIT);
+    _delay_us(LCD_E_US);                         //data out 360ns after E rises
+    bf = LCD_PIN & 0x80;                         //busy flag, upper nibble
+    LCD_PORT &= ~(1<<LCD_STROBE_BIT);
+    _delay_us(LCD_E_US);
+    strobe_lcd();                                //lower nibble, not used
+  }
+  LCD_PORT &= ~(1<<LCD_RDWR_BIT);                //back to write
+  LCD_PORT_DDR |= 0xF0;
+  return(!bf);
+}
+#endif
+
+//-----------------------------------------------------------------------------
+//                               lcd_addr
+//
+// DDRAM address of cell i of the array, see refresh_lcd(). Lines 3 and 4 go
+// on from the ends of lines 1 and 2.
+//
+static uint8_t lcd_addr(uint8_t i){
+  uint8_t row = 0;
+
+  while(i >= LCD_COLS){i -= LCD_COLS; row++;}
+  return(((row & 1) ? 0x40 : 0x00) + ((row & 2) ? LCD_COLS : 0) + i);
+}
+
+//-----------------------------------------------------------------------------
+//                               lcd_queue
+//
+// Adds a byte and the time it takes the LCD to the queue. Returns FALSE, and
+// counts it, if the queue is full.
+//
+static uint8_t lcd_queue(uint8_t flags, uint8_t byte, uint16_t wait){
+  uint8_t head = lcd_q_head;
+
+  if(((head + 1) & (LCD_QUEUE - 1)) == lcd_q_tail){lcd_q_dropped++; return(0);}
+  lcd_q[head].flags = flags;
+  lcd_q[head].byte  = byte;
+  lcd_q[head].wait  = wait;
+  lcd_q_head = (head + 1) & (LCD_QUEUE - 1);
+#if LCD_SYNC
+  lcd_flush();       //no ISR to send it, so send it now
+#endif
+  return(1);
+}
+
+//-----------------------------------------------------------------------------
+//                               send_lcd
+//
+// Queues a command or character data for the lcd. First argument of 0x00 indicates 
+// a command transfer while 0x01 indicates data transfer.  The next byte is the 
+// command or character byte. 
+//
+// This is a low-level function usually called by the other functions but may
+// be called directly to provide more control. It returns at once; the byte
+// goes out from refresh_lcd() once the LCD is done with the one before. Most
+// commands require 37us to complete, and are given 40us. Commands that
+// require more time have their own functions that queue them with it.
+//
+void send_lcd(uint8_t cmd_or_char, uint8_t byte){
+  lcd_queue(cmd_or_char ? LCD_Q_CHAR : 0, byte, LCD_CMD_US);
+}
+
+//-----------------------------------------------------------------------------
+//                               lcd_busy
+//
+// TRUE while anything queued has not been sent.
+//
+uint8_t lcd_busy(void){return(lcd_q_head != lcd_q_tail);}
+
+//-----------------------------------------------------------------------------
+//                               lcd_get_dropped
+//
+// Bytes thrown away because the queue was full.
+//
+uint16_t lcd_get_dropped(void){
+  uint16_t n;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){n = lcd_q_dropped;}
+  return(n);
+}
+
+//-----------------------------------------------------------------------------
+//                               lcd_changed
+//
+// Moves lcd_cell to the next cell that differs from the shadow, starting at
+// lcd_cell itself. FALSE if the LCD is up to date. A second call finds the
+// same cell with one compare.
+//
+static uint8_t lcd_changed(char lcd_string_array[]) {
+  uint8_t n;
+
+  for(n = 0; n < LCD_CELLS; n++, lcd_cell = (lcd_cell == LCD_CELLS - 1) ? 0 : lcd_cell + 1){
+    if(lcd_string_array[lcd_cell] != lcd_shadow[lcd_cell]){return(1);}
+  }
+  return(0);
+}
+
 //------------------------------------------------------------------
 //                          refresh_lcd 
 //
-//When called, writes one character to the LCD.  On each call it     
-//increments a pointer so that after 32 calls, the entire lcd is    
-//written. The calling program is responsible for not calling this 
-//function more often than every 80us which is the maximum amount 
-//of time it might take for any operation to take in this function.
-//This includes the possibility for a movement to the next line. 
-//These functions are homeline() or homeline2. 
-//
-//The array is organized as one array of 32 char locations to make 
+//Called from a timer ISR every LCD_TICK_US. Once the LCD is done with the
+//last byte sent, sends the next queued command if there is one, and
+//otherwise brings one cell of the LCD up to date with the array. With
+//LCD_FIXED done means its worst case execution time is up; with
+//LCD_BUSY_FLAG the busy flag is read, see below.
+//A shadow copy of what the LCD shows is compared with the array, and only a
+//cell that differs is sent. The DDRAM address is only set when that cell is
+//not the one the LCD address counter already points at, so a run of changed
+//cells goes out as one address command and then one byte per cell. The
+//address command and the character each count as one byte, and once the
+//LCD matches the array and the queue is empty a call sends nothing at all.
+//
+//The shadow is only right if everything else written to the LCD is followed
+//by clear_display(), which lcd_init() does.
+//
+//The array is organized as one array of LCD_CELLS char locations to make 
 //the index handling easier.  To external functions that write into 
-//the array it will appear as two separate 16 location arrays by 
-//using an offset into the array address.
+//the array it will appear as LCD_ROWS separate LCD_COLS location arrays
+//by using an offset into the array address.
 //
 //        LCD display character index postions (2x16 display)
 //  -----------------------------------------------------------------
@@ -81,19 +228,92 @@ void send_lcd(uint8_t cmd_or_char, uint8_t byte){
 //  | 16| 17| 18| 19| 20| 21| 22| 23| 24| 25| 26| 27| 28| 29| 30| 31|  
 //  -----------------------------------------------------------------
 //
-void refresh_lcd(char lcd_string_array[]) {
+static uint8_t lcd_next(char lcd_string_array[]) {
+  uint8_t i, tail;
 
-  static uint8_t i=0;           // index into string array 
+  //queued commands go first, the array waits until they are all out
+  tail = lcd_q_tail;
+  if(tail != lcd_q_head){
+    if(!(lcd_q[tail].flags & LCD_Q_DELAY)){lcd_write(lcd_q[tail].flags, lcd_q[tail].byte);}
+    if(lcd_q[tail].flags & LCD_Q_CLEARED){
+      memset(lcd_shadow, ' ', sizeof(lcd_shadow));
+      lcd_cursor = 0;
+    }
+    else{lcd_cursor = LCD_CURSOR_UNKNOWN;} //may have moved the address counter
+    lcd_wait  = lcd_q[tail].wait;
+#if LCD_TIMING==LCD_BUSY_FLAG
+    lcd_timed = lcd_q[tail].flags & LCD_Q_TIMED;
+#endif
+    lcd_q_tail = (tail + 1) & (LCD_QUEUE - 1);
+    return(1);
+  }
+
+  if(!lcd_changed(lcd_string_array)){return(0);} //LCD is up to date
+  i = lcd_cell;
+
+  lcd_wait  = LCD_CMD_US;
+#if LCD_TIMING==LCD_BUSY_FLAG
+  lcd_timed = 0;
+#endif
+  if(lcd_cursor != i){          //move the address counter, the char goes next
+    lcd_write(0, SET_DDRAM_ADDR | lcd_addr(i));
+    lcd_cursor = i;
+    return(1);
+  }
+  lcd_shadow[i] = lcd_string_array[i];
+  lcd_write(LCD_Q_CHAR, lcd_shadow[i]);
+  //the address counter runs on from the last column into off screen DDRAM,
+  //or another line, so the cell after a line end needs an address command
+  lcd_cursor = ((i + 1) % LCD_COLS) ? i + 1 : LCD_CURSOR_UNKNOWN;
+  lcd_cell = (i == LCD_CELLS - 1) ? 0 : i + 1;
+  return(1);
+}
 
- send_lcd(CHAR_BYTE,lcd_string_array[i]);
- i++;   //increment to next character
- //delays are inserted to allow character to be written before moving
- //the cursor to the next line.
- if(i == 16){_delay_us(40); line2_col1();      } //goto line 2, 1st char 
- if(i == 32){_delay_us(40); line1_col1(); i=0; } //goto line 1, 1st char 
+void refresh_lcd(char lcd_string_array[]) {
+#if LCD_TIMING==LCD_FIXED
+  //the LCD isn't read, so it is given the worst case time of the last byte
+  if(lcd_wait > LCD_TICK_US){lcd_wait -= LCD_TICK_US; return;}
+  lcd_wait = 0;
+  lcd_next(lcd_string_array);
+#else
+  //the busy flag says when the last byte is done, so up to LCD_BURST bytes
+  //go out while the LCD keeps up. If it stays busy the worst case time is
+  //counted down as in SPI mode, and once that is over the next byte goes
+  //anyway, so a dead RW line only makes the LCD slow. With nothing to send
+  //the LCD is not read at all, only the worst case time runs down.
+  uint8_t burst;
+
+  for(burst = 0; burst < LCD_BURST; burst++){
+    if(lcd_q_tail == lcd_q_head && !lcd_changed(lcd_string_array)){
+      if(!burst){lcd_wait = (lcd_wait > LCD_TICK_US) ? lcd_wait - LCD_TICK_US : 0;}
+      return;
+    }
+    if(lcd_timed || !lcd_ready()){
+      if(burst){return;}        //this call has sent something, wait for the next
+      if(lcd_wait > LCD_TICK_US){lcd_wait -= LCD_TICK_US; return;}
+    }
+    if(!lcd_next(lcd_string_array)){return;}
+  }
+#endif
 }//refresh_lcd
 /***********************************************************************/
 
+//-----------------------------------------------------------------------------
+//                          lcd_flush
+//
+//For a program with no timer ISR calling refresh_lcd(). Sends everything
+//queued, waiting LCD_TICK_US between refresh_lcd() calls, and returns once
+//the LCD is done with the last byte. The shadow stands in for the array so
+//only the queue goes out. With LCD_SYNC every call that queues does this.
+//Not for use while an ISR calls refresh_lcd().
+//
+void lcd_flush(void){
+  while(lcd_busy() || lcd_wait){
+    refresh_lcd(lcd_shadow);
+    _delay_us(LCD_TICK_US);
+  }
+}
+
 //-----------------------------------------------------------------------------
 //                          set_custom_character
 //
@@ -121,19 +341,19 @@ void refresh_lcd(char lcd_string_array[]) {
 
 void set_custom_character(uint8_t data[], uint8_t address){
     uint8_t i;
-    send_lcd(CMD_BYTE, 0x40 + (address << 3)); _delay_us(40);  //only needs 37uS
+    send_lcd(CMD_BYTE, 0x40 + (address << 3));
     for(i=0; i<8; i++){
-      send_lcd(CHAR_BYTE, data[i]); _delay_us(40); //each char byte takes 37us to execute
+      send_lcd(CHAR_BYTE, data[i]);
     }
 }
 
 //-----------------------------------------------------------------------------
 //                          set_cursor 
 //
-//Sets the cursor to an arbitrary potition on the screen, row is either 1 or 2
-//col is a number form 0-15, counting from left to right
+//Sets the cursor to an arbitrary potition on the screen, row is 1 to LCD_ROWS
+//col is a number form 0 to LCD_COLS-1, counting from left to right
 void set_cursor(uint8_t row, uint8_t col){
-    send_lcd(CMD_BYTE, 0x80 + col + ((row-1)*0x40));
+    send_lcd(CMD_BYTE, SET_DDRAM_ADDR | lcd_addr((row-1)*LCD_COLS + col));
 }
 //TODO: use this method of moving the cursor in the other cursor moving routines
 
@@ -162,7 +382,7 @@ void uint2lcd(uint8_t number){
 //
 void int2lcd(int8_t number){
     //if < 0, print minus sign, then take 2's complement of number and display
-    if(number < 0){send_lcd(CHAR_BYTE, '-'); _delay_us(40); uint2lcd(~number+1);}  
+    if(number < 0){send_lcd(CHAR_BYTE, '-'); uint2lcd(~number+1);}  
     else          {uint2lcd(number);                                            }
 }
 
@@ -193,19 +413,19 @@ void shift_left(void){send_lcd(CMD_BYTE, 0x18);}
 //-----------------------------------------------------------------------------
 //                          strobe_lcd  
 //Strobes the "E" pin on the LCD module. How this is done depends on the interface
-//style. The 4-bit mode is presently kludged with nop statements to make a suitable
-//pulse width for a 4 Mhz clock.
-//TODO: make number of nops executed dependent on F_CPU, not hardcoded
+//style. In 4-bit mode E is held high, then low, for LCD_E_US each, which
+//_delay_us() turns into cycles for F_CPU.
 //
 void strobe_lcd(void){ 
-#if SPI_MODE==1
- PORTF |=  0x08; PORTF &= ~0x08; //toggle port F bit 3, LCD strobe trigger
+#if LCD_TRANSPORT==LCD_SPI
+ LCD_SPI_E_PORT |=  (1<<LCD_SPI_E_BIT);     //LCD strobe trigger
+ LCD_SPI_E_PORT &= ~(1<<LCD_SPI_E_BIT);
 #else
 //4-bit mode below
  LCD_PORT |= (1<<LCD_STROBE_BIT);           //set strobe bit
- asm("nop"); asm("nop"); asm("nop"); asm("nop"); //4 cycle wait 
+ _delay_us(LCD_E_US);                       //E high 230ns min
  LCD_PORT &= ~(1<<LCD_STROBE_BIT);          //clear strobe bit
- asm("nop"); asm("nop"); asm("nop"); asm("nop"); //4 cycle wait 
+ _delay_us(LCD_E_US);                       //E cycle 500ns min
 #endif
 }
  
@@ -213,24 +433,34 @@ void strobe_lcd(void){
 //                          clear_display  
 //
 //Clears entire display and sets DDRAM address 0 in address counter. Requires
-//1.8ms for execution. Use only if you can withstand the big delay.
+//1.8ms for execution, which is queued with it, so nothing else goes to the
+//LCD until it is done.
 //
 void clear_display(void){
-  send_lcd(CMD_BYTE, CLEAR_DISPLAY);
-  _delay_us(1800);   //1.8ms wait for LCD execution
+  lcd_queue(LCD_Q_CLEARED, CLEAR_DISPLAY, LCD_CLEAR_US);
 } 
 
+//-----------------------------------------------------------------------------
+//                          lcd_get_bytes
+//
+//Bytes sent to the LCD so far, commands included. Wraps. The difference of
+//two reads a second apart is the LCD traffic in bytes per second.
+//
+uint16_t lcd_get_bytes(void){
+  uint16_t n;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){n = lcd_bytes;}
+  return(n);
+}
+
 //-----------------------------------------------------------------------------
 //                          cursor_home()    
 //
 //Sets DDRAM address 0 in address counter. Also returns display from being 
 //shifted to original position.  DDRAM contents remain unchanged. Requires
-//1.5ms to execute. Use only if you can withstand the big delay. Consider
-//using line1_col1().
+//1.5ms to execute, queued with it. Consider using line1_col1().
 //
 void cursor_home(void){
-  send_lcd(CMD_BYTE, RETURN_HOME);
-  _delay_us(1500);  //1.5ms wait for LCD execution
+  lcd_queue(0, RETURN_HOME, LCD_HOME_US);
   } 
   
 //-----------------------------------------------------------------------------
@@ -261,9 +491,8 @@ void line1_col1(void){
 //Fill an entire line with spaces.
 void fill_spaces(void){
 	uint8_t i;
-	for (i=0; i<=(NUM_LCD_CHARS-1); i++){
+	for (i=0; i<=(LCD_COLS-1); i++){
 		send_lcd(CHAR_BYTE, ' '); 
-                _delay_us(40);  //40us wait between characters
 	}
 }  
    
@@ -280,30 +509,28 @@ void char2lcd(char a_char){send_lcd(CHAR_BYTE, a_char);}
 //                            
 //Send a ascii string to the LCD.
 void string2lcd(char *lcd_str){ 
-  uint8_t i;
-  for (i=0; i<=(strlen(lcd_str)-1); i++){send_lcd(CHAR_BYTE, lcd_str[i]);
-  _delay_us(40);  //execution takes 37us per character
-  }                  
+  while(*lcd_str){send_lcd(CHAR_BYTE, *lcd_str++);}
 } 
 
 //----------------------------------------------------------------------------
 //                            lcd_int 
 //
-//Initalize the LCD 
+//Initalize the LCD. The whole sequence, delays included, is queued and run
+//by refresh_lcd() once the timer interrupt is going, so this returns at once.
+//With LCD_SYNC it runs here, about 50ms.
 //
 void lcd_init(void){
-  _delay_ms(16);      //power up delay
-#if SPI_MODE==1       //assumption is that the SPI port is intialized
-  //TODO: kludge alert! setting of DDRF should not be here, but is probably harmless.
-  DDRF=0x08;          //port F bit 3 is enable for LCD in SPI mode
-  send_lcd(CMD_BYTE, 0x30); _delay_ms(7); //send cmd sequence 3 times 
-  send_lcd(CMD_BYTE, 0x30); _delay_ms(7);
-  send_lcd(CMD_BYTE, 0x30); _delay_ms(7);
-  send_lcd(CMD_BYTE, 0x38); _delay_ms(5);
-  send_lcd(CMD_BYTE, 0x08); _delay_ms(5);
-  send_lcd(CMD_BYTE, 0x01); _delay_ms(5);
-  send_lcd(CMD_BYTE, 0x06); _delay_ms(5);
-  send_lcd(CMD_BYTE, 0x0C + (CURSOR_VISIBLE<<1) + CURSOR_BLINK); _delay_ms(5);
+  lcd_queue(LCD_Q_DELAY | LCD_Q_TIMED, 0, 16000);   //power up delay
+#if LCD_TRANSPORT==LCD_SPI //assumption is that the SPI port is intialized
+  LCD_SPI_E_DDR |= (1<<LCD_SPI_E_BIT); //enable for LCD in SPI mode
+  lcd_queue(0, 0x30, 7000); //send cmd sequence 3 times 
+  lcd_queue(0, 0x30, 7000);
+  lcd_queue(0, 0x30, 7000);
+  lcd_queue(0, LCD_FUNCTION_SET, 5000);
+  lcd_queue(0, 0x08, 5000);
+  lcd_queue(LCD_Q_CLEARED, 0x01, 5000);
+  lcd_queue(0, 0x06, 5000);
+  lcd_queue(0, 0x0C + (CURSOR_VISIBLE<<1) + CURSOR_BLINK, 5000);
 #else //4-bit mode
   LCD_PORT_DDR = 0xF0                    | //initalize data pins
                  ((1<<LCD_CMD_DATA_BIT)  | //initalize control pins
@@ -311,16 +538,15 @@ void lcd_init(void){
                   (1<<LCD_RDWR_BIT)    ); 
   //do first four writes in 8-bit mode assuming reset by instruction
   //command and write are asserted as they are initalized to zero
-  LCD_PORT = 0x30; strobe_lcd(); _delay_ms(8);  //function set,   write lcd, delay > 4.1ms
-  LCD_PORT = 0x30; strobe_lcd(); _delay_us(200);//function set,   write lcd, delay > 100us
-  LCD_PORT = 0x30; strobe_lcd(); _delay_us(80); //function set,   write lcd, delay > 37us
-  LCD_PORT = 0x20; strobe_lcd(); _delay_us(80); //set 4-bit mode, write lcd, delay > 37us
+  lcd_queue(LCD_Q_NIBBLE | LCD_Q_TIMED, 0x30, 8000); //function set,   write lcd, delay > 4.1ms
+  lcd_queue(LCD_Q_NIBBLE | LCD_Q_TIMED, 0x30, 200);  //function set,   write lcd, delay > 100us
+  lcd_queue(LCD_Q_NIBBLE | LCD_Q_TIMED, 0x30, 80);   //function set,   write lcd, delay > 37us
+  lcd_queue(LCD_Q_NIBBLE | LCD_Q_TIMED, 0x20, 80);   //set 4-bit mode, write lcd, delay > 37us
   //continue initalizing the LCD, but in 4-bit mode
-  send_lcd(CMD_BYTE, 0x28); _delay_ms(7); //function set: 4-bit, 2 lines, 5x8 font
-  //send_lcd(CMD_BYTE, 0x08, 5000);
-  send_lcd(CMD_BYTE, 0x01); _delay_ms(7)  //clear display
-  send_lcd(CMD_BYTE, 0x06);  _delay_ms(5) //cursor moves to right, don't shift display
-  send_lcd(CMD_BYTE, 0x0C | (CURSOR_VISIBLE<<1) | CURSOR_BLINK); _delay_ms(5);
+  lcd_queue(LCD_Q_TIMED, LCD_FUNCTION_SET, 7000); //function set: 4-bit, lines, 5x8 font
+  lcd_queue(LCD_Q_CLEARED, 0x01, 7000); //clear display
+  lcd_queue(0, 0x06, 5000); //cursor moves to right, don't shift display
+  lcd_queue(0, 0x0C | (CURSOR_VISIBLE<<1) | CURSOR_BLINK, 5000);
 #endif
 }
 
@@ -344,7 +570,7 @@ void  lcd_int32(int32_t l,          //number to display
                 uint8_t bSigned,    //non-zero if the number should be treated as signed 
                 uint8_t bZeroFill)  //non-zero if a specified fieldwidth is to be zero filled
 {
-      char    sline[NUM_LCD_CHARS+1];
+      char    sline[LCD_COLS+1];
       uint8_t i=0;
       char    fillch;
       ldiv_t  qr;
@@ -381,7 +607,7 @@ void  lcd_int32(int32_t l,          //number to display
       if (bSigned){sline[i++] = '-';}
 
       // now output the formatted number
-      do{send_lcd(CHAR_BYTE, sline[--i]); _delay_us(40);} while(i);
+      do{send_lcd(CHAR_BYTE, sline[--i]);} while(i);
 
 }
 
@@ -408,7 +634,7 @@ void    lcd_int16(int16_t l,
                   uint8_t decpos, 
                   uint8_t bZeroFill)
 {
-        char    sline[NUM_LCD_CHARS+1];
+        char    sline[LCD_COLS+1];
         uint8_t i=0;
         char    fillch;
         div_t   qr;
@@ -455,6 +681,6 @@ void    lcd_int16(int16_t l,
         if (bSigned){sline[i++] = '-';}
 
         // now output the formatted number 
-            do{send_lcd(CHAR_BYTE, sline[--i]); _delay_us(40);} while(i);
+            do{send_lcd(CHAR_BYTE, sline[--i]);} while(i);
 }
 
@@ -44,19 +44,98 @@ set cursor position                             0x80+position
 #define LCD_CMD_DATA_BIT   1    //zero is command, one is data
 #define LCD_RDWR_BIT       2    //zero is write,   one is read
 #define LCD_STROBE_BIT     3    //active high strobe
+#define LCD_PIN            PIND //for the busy flag, on the data line MSB
 
-//Set to the width of the display, assumption is a two line display
-#define NUM_LCD_CHARS 16
+//SPI mode strobe. The data goes through the shift register on the SPI port,
+//E is a port pin of its own.
+#define LCD_SPI_E_PORT     PORTF
+#define LCD_SPI_E_DDR      DDRF
+#define LCD_SPI_E_BIT      3
 
-//Set the the lcd interface mode. One indicates SPI mode, zero 
-//indicates 4-bit mode. SPI mode assumes lcd is write only and
-//that the SPI port is already initalized. 4-bit mode initalizes 
-//the RW bit as write. Busy flag reads will set it to read for
-//as long as the Busy bit is read.
-#define SPI_MODE          1
+//4-bit mode timing. LCD_E_US is both the E pulse width and the low time
+//after it, for _delay_us(), so the strobe fits F_CPU. The busy flag is read
+//at most LCD_BF_TRIES times for each byte, and at most LCD_BURST bytes go
+//out per refresh_lcd() call, which bounds the time spent in the ISR.
+#define LCD_E_US           0.5
+#define LCD_BF_TRIES       4
+#define LCD_BURST          4
+
+//Driver configuration, fixed at compile time. Only the code for the chosen
+//transport and timing is built. Each can be overridden from DEFS in the
+//Makefile, e.g. DEFS = -DLCD_TRANSPORT=LCD_4BIT, and "make lcd_sizes"
+//prints the flash and RAM hd44780.o takes in each combination. Those sizes
+//have not been recorded here yet, run it with the avr-gcc in use.
+//
+//LCD_TRANSPORT  LCD_SPI:  through the shift register on the SPI port, write
+//                         only. The SPI port must already be initialized.
+//               LCD_4BIT: 4-bit parallel on LCD_PORT. RW is driven low, and
+//                         only set to read while the busy flag is read.
+//LCD_TIMING     LCD_FIXED:     each byte is given its worst case time.
+//               LCD_BUSY_FLAG: the busy flag is read, 4-bit only.
+//LCD_COLS       width of the display
+//LCD_ROWS       lines, 1 to 4. Lines 3 and 4 are the ends of lines 1 and 2
+//               in DDRAM, as on 4x16 and 4x20 modules.
+//LCD_SYNC       0: a timer ISR calls refresh_lcd() and no call waits.
+//               1: there is no such ISR. Every call sends what it queued
+//                  and waits for the LCD before it returns, see lcd_flush().
+//
+//Cost of one character, F_CPU 16MHz. Estimates counted by hand from the
+//source, not measured on the chip or in a simulator:
+//  LCD_SPI                   ~75 cycles  one per refresh_lcd() call
+//  LCD_4BIT, LCD_FIXED       ~85 cycles  one per refresh_lcd() call
+//  LCD_4BIT, LCD_BUSY_FLAG  ~155 cycles  up to LCD_BURST per call
+//With the LCD up to date and the queue empty a call reads nothing and
+//sends nothing, in every configuration. With LCD_SYNC and LCD_FIXED a
+//character takes two LCD_TICK_US steps, 256us, where lcd_functions.c gave
+//each 1ms (host model of lcd_flush(), delays counted, not measured).
+#define LCD_SPI           1
+#define LCD_4BIT          2
+#define LCD_FIXED         1
+#define LCD_BUSY_FLAG     2
+
+#ifndef LCD_TRANSPORT
+#define LCD_TRANSPORT     LCD_SPI
+#endif
+#ifndef LCD_TIMING
+#if LCD_TRANSPORT==LCD_4BIT
+#define LCD_TIMING        LCD_BUSY_FLAG
+#else
+#define LCD_TIMING        LCD_FIXED
+#endif
+#endif
+#ifndef LCD_COLS
+#define LCD_COLS          16
+#endif
+#ifndef LCD_ROWS
+#define LCD_ROWS          2
+#endif
+#define LCD_CELLS         (LCD_COLS * LCD_ROWS)
+#ifndef LCD_SYNC
+#define LCD_SYNC          0
+#endif
+
+#if LCD_TRANSPORT!=LCD_SPI && LCD_TRANSPORT!=LCD_4BIT
+#error "LCD_TRANSPORT must be LCD_SPI or LCD_4BIT"
+#endif
+#if LCD_TIMING!=LCD_FIXED && LCD_TIMING!=LCD_BUSY_FLAG
+#error "LCD_TIMING must be LCD_FIXED or LCD_BUSY_FLAG"
+#endif
+#if LCD_TIMING==LCD_BUSY_FLAG && LCD_TRANSPORT==LCD_SPI
+#error "the SPI shift register can't read the busy flag, use LCD_FIXED"
+#endif
+#if LCD_ROWS < 1 || LCD_ROWS > 4 || LCD_CELLS > 80
+#error "LCD_ROWS is 1 to 4, and the HD44780 holds 80 characters"
+#endif
+
+//Everything sent to the LCD is queued with the time the LCD needs to
+//execute it, and refresh_lcd(), called from a timer ISR every LCD_TICK_US,
+//sends the next entry only once that time is up. No LCD call waits.
+#define LCD_QUEUE         32    //entries, must be a power of two
+#ifndef LCD_TICK_US
+#define LCD_TICK_US       128   //refresh_lcd() period, TIMER2 overflow in lab6
+#endif
 
 void send_lcd(uint8_t cnd_or_char, uint8_t data);
-void send_lcd_8bit(uint8_t cnd_or_char, uint8_t data, uint16_t wait);
 void set_custom_character(uint8_t data[], uint8_t address);
 void set_cursor(uint8_t row, uint8_t col);
 void uint2lcd(uint8_t number);
@@ -75,7 +154,9 @@ void clear_display(void);
 void char2lcd(char a_char);
 void lcd_init(void);
 void refresh_lcd(char lcd_string_array[]);
+void lcd_flush(void);
+uint16_t lcd_get_bytes(void);
+uint16_t lcd_get_dropped(void);
+uint8_t lcd_busy(void);
 void lcd_int32(int32_t l, uint8_t fieldwidth, uint8_t decpos, uint8_t bSigned, uint8_t bZeroFill);
 void lcd_int16(int16_t l, uint8_t fieldwidth, uint8_t decpos, uint8_t bZeroFill);
-void set_DDRAM_addr16(void);
-void set_DDRAM_addr0(void);
@@ -45,6 +45,8 @@
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <avr/pgmspace.h>
 #include <string.h>
 #include <stdlib.h>
 #include "hd44780.h"
@@ -52,6 +54,10 @@
 #include "lm73_functions.h"
 #include "uart_functions.h"
 #include "si4734.h"
+#include "settings.h"
+#include "remote_link.h"
+#include "log.h"
+#include "console.h"
 
 //#define FALSE   0
 //#define TRUE    1
@@ -121,6 +127,7 @@ int8_t alarm_sec = 0;
 uint8_t alarm_AM = TRUE;
 
 volatile int16_t volume = 0x0FA3;
+volatile uint16_t timer2_ticks = 0;
 
 // General flags
 uint8_t Colon_Status = FALSE;
@@ -131,33 +138,41 @@ uint8_t alarm_going_off = FALSE;
 // TWI arrays
 extern uint8_t lm73_wr_buf[2];
 extern uint8_t lm73_rd_buf[2];
+volatile uint8_t lm73_status; //TWI_XFER_* bits of the LM73 read in flight
+#if TWI_INSTRUMENT
+volatile uint8_t twi_dump_flag = FALSE;
+#endif
 uint16_t lm73_temp;
 char lm73_char_temp[8];
-char remote_temp;
-uint8_t remote_byte = 1;
 
 // Radio Variables
-enum radio_band{FM, AM, SW};
-volatile enum radio_band current_radio_band;
+volatile enum radio_band current_radio_band = FM;
 uint8_t freq_disp_flag = FALSE;
 uint8_t freq_disp_counter = 0;
 
-uint16_t eeprom_fm_freq;
-uint16_t eeprom_am_freq;
-uint16_t eeprom_sw_freq;
-uint8_t eeprom_volume;
-
-uint16_t current_fm_freq;
-uint16_t current_am_freq;
-uint16_t current_sw_freq;
+//defaults until settings_load() finds saved ones
+uint16_t current_fm_freq = 10630;
+uint16_t current_am_freq = 1190;
+uint16_t current_sw_freq = 9500;
 uint8_t current_volume;
-extern uint8_t STC_interrupt;
 
 
 // LCD arrays
 char mode_text[16] = "Normal Mode     ";
 char temp_text[16] = "In:   C Out:   C";
-char lcd_display[32];
+char lcd_display[LCD_CELLS];
+#if LCD_COLS != 16 || LCD_ROWS != 2
+#error "the lab6 screens are laid out for a 2x16 LCD"
+#endif
+uint16_t lcd_bytes_last;
+volatile uint16_t lcd_rate;    //bytes sent to the LCD in the last second
+
+// ISR counters for the console stats command. Runs are timed on TCNT3 (clk/1)
+// which counts 0 to OCR3A (0x2000), so a run past 512us reads short.
+enum isr_id {ISR_T0, ISR_T2, ISR_INT7, ISR_ADC, ISR_CNT};
+volatile uint16_t isr_entries[ISR_CNT]; //entries so far this second
+volatile uint16_t isr_rate[ISR_CNT];    //entries in the last second
+volatile uint16_t isr_worst[ISR_CNT];   //longest run since the last stats, TCNT3 counts
 
 uint8_t single_shot = FALSE;
 
@@ -207,13 +222,17 @@ uint8_t chk_buttons(uint8_t button) {
 void format_clk_array(uint8_t hours, uint8_t minutes) {
 
     if(freq_disp_flag) {
+        //FM as 106.3 (MHz), AM as 1190 (kHz), SW as 09.50 (MHz)
         uint16_t disp_freq = current_fm_freq / 10;
+        if(current_radio_band == AM) { disp_freq = current_am_freq; }
+        if(current_radio_band == SW) { disp_freq = current_sw_freq / 10; }
         segment_data[0] = dec_to_7seg[disp_freq % 10];
         segment_data[1] = dec_to_7seg[(disp_freq / 10) % 10];
-        segment_data[1] &= ~(1 << 7); //turn on decimal point
         segment_data[2] = COLON_OFF;
         segment_data[3] = dec_to_7seg[(disp_freq / 100) % 10];
         segment_data[4] = dec_to_7seg[(disp_freq / 1000) % 10];
+        if(current_radio_band == FM) { segment_data[1] &= ~(1 << 7); } //turn on decimal point
+        if(current_radio_band == SW) { segment_data[3] &= ~(1 << 7); }
     }
     else { 
         //break up decimal sum into 4 digit-segments
@@ -408,8 +427,10 @@ void get_button_input() {
                 if(chk_buttons(i)) { current_mode &= ~(1 << i); }
             }
             //turn radio off or on by muting (0x0003) or unmuting
-            if(chk_buttons(0)) { set_property(0x4001, 0x0000); }
-            if(chk_buttons(1)) { set_property(0x4001, 0x0003); }
+            if(chk_buttons(0)) { set_property(RX_HARD_MUTE, 0x0000); }
+            if(chk_buttons(1)) { set_property(RX_HARD_MUTE, 0x0003); }
+            //rebuild the station table in the background
+            if(chk_buttons(4)) { fm_scan_start(); }
             
             if(alarm_going_off) {
                 //snooze function
@@ -427,6 +448,12 @@ void get_button_input() {
                     memcpy(mode_text, "Normal Mode     ", 16);
                 }
             }//if alarm_going_off
+            //step through FM, AM and SW
+            else if(chk_buttons(3)) {
+                radio_band_switch((current_radio_band + 1) % SI4734_BANDS);
+                freq_disp_flag = TRUE;
+                freq_disp_counter = 0;
+            }
             break;
 
         case SET_CLK:
@@ -598,10 +625,30 @@ void encoder2_instruction(uint8_t encoder2_val) {
             if(add != 0) {
                 freq_disp_flag = TRUE;
                 freq_disp_counter = 0;
-                current_fm_freq = current_fm_freq + add * 20;
-                if(current_fm_freq < 8890) { current_fm_freq = 8890; }
-                if(current_fm_freq > 10790) { current_fm_freq = 10790; }
-                fm_tune_freq();
+                if(radio_switching()) { break; } //tuned once the new band is up
+                switch(current_radio_band)
+                {
+                    case FM:
+                        //jump between stations found by the scan, or step the band without a table
+                        if(fm_station_step(add)) { break; }
+                        current_fm_freq = current_fm_freq + add * FM_BAND_SPACING;
+                        if(current_fm_freq < FM_BAND_BOTTOM) { current_fm_freq = FM_BAND_BOTTOM; }
+                        if(current_fm_freq > FM_BAND_TOP) { current_fm_freq = FM_BAND_TOP; }
+                        radio_tune_request(); //sent when the last tune is done, display shows it now
+                        break;
+                    case AM:
+                        current_am_freq = current_am_freq + add * AM_BAND_SPACING;
+                        if(current_am_freq < AM_BAND_BOTTOM) { current_am_freq = AM_BAND_BOTTOM; }
+                        if(current_am_freq > AM_BAND_TOP) { current_am_freq = AM_BAND_TOP; }
+                        radio_tune_request();
+                        break;
+                    case SW:
+                        current_sw_freq = current_sw_freq + add * SW_BAND_SPACING;
+                        if(current_sw_freq < SW_BAND_BOTTOM) { current_sw_freq = SW_BAND_BOTTOM; }
+                        if(current_sw_freq > SW_BAND_TOP) { current_sw_freq = SW_BAND_TOP; }
+                        radio_tune_request();
+                        break;
+                }//switch
             }
             break;
         case SET_CLK:
@@ -755,6 +802,468 @@ void mode_handler() {
 }//mode_handler
 
 
+/***********************************************************************************
+* Function: update_local_temp
+* Parameters: none
+* Return: none
+* Description: Picks up the LM73 reading once the TWI driver reports that the 
+*   read has completed and formats it into the LCD temperature text. A failed
+*   read shows as dashes until the next good one. TIMER0 does not post the
+*   next read while the status still shows DONE, so lm73_rd_buf is copied
+*   out before the status is cleared and handed back.
+*******************************************************************************/
+
+void update_local_temp() {
+    uint8_t i;
+    uint8_t status;
+    uint8_t rd[2];
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        status = lm73_status;
+        if(status & TWI_XFER_DONE) {
+            rd[0] = lm73_rd_buf[0];
+            rd[1] = lm73_rd_buf[1];
+            lm73_status = 0;    //TIMER0 may post the next read now
+        }
+    }
+    if(!(status & TWI_XFER_DONE)) { return; } //nothing new yet
+
+    if(status & TWI_XFER_ERROR) {
+        twi_error(); //clear the saved TWSR
+        temp_text[4] = '-';
+        temp_text[5] = '-';
+        return;
+    }
+
+    //format temp array
+    lm73_temp = (rd[0] << 8) | (rd[1]);
+    lm73_temp = lm73_temp >> 7;
+    itoa(lm73_temp, lm73_char_temp, 10);
+    for(i = 0; i < 2; i++)
+        temp_text[i+4] = lm73_char_temp[i];
+
+}//update_local_temp
+
+
+/***********************************************************************************
+* Function: remote_poll
+* Parameters: none
+* Return: none
+* Description: Queues a LINK_POLL frame asking the ATMega48 for a temperature
+*   frame. Never waits. The node pushes readings by itself, so this is only
+*   needed at boot and when they stop coming.
+*******************************************************************************/
+
+void remote_poll() {
+    static uint8_t seq = 0;
+    uint8_t frame[LINK_OVERHEAD];
+
+    link_frame(frame, LINK_POLL, seq++, NULL, 0);
+    uart_write(frame, sizeof(frame));
+
+}//remote_poll
+
+
+/***********************************************************************************
+* Function: update_remote_temp
+* Parameters: none
+* Return: none
+* Description: Runs the bytes waiting in the USART0 receive ring through the
+*   link receiver and puts the temperature from each good LINK_TEMP frame on
+*   the LCD. Frames that fail the CRC are dropped by the receiver; frames
+*   not newer than the last one taken (by seq, unless the node says it has
+*   reset) are dropped here as stale. With no reading for LINK_STALE_SEC
+*   the C after the remote temperature becomes a ?, and the node is polled
+*   at once, then every LINK_HEARTBEAT_SEC until it answers. The polls are
+*   timed off remote_secs, which wraps, as remote_age stops at 0xFFFF.
+*******************************************************************************/
+
+link_rx_t remote_rx;
+uint16_t remote_stale = 0;
+volatile uint16_t remote_age = 0xFFFF; //seconds since the last reading, counted by TIMER0
+volatile uint16_t remote_secs = 0;     //free running seconds, counted by TIMER0
+
+void update_remote_temp() {
+    static uint8_t last_seq;
+    static uint8_t seen = FALSE;
+    static uint8_t poll_now = TRUE;    //no poll since the last reading
+    static uint16_t polled_at;         //remote_secs at the last poll
+    link_temp_t t;
+    int16_t deg;
+    uint16_t age, secs;
+    uint8_t c;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { age = remote_age; secs = remote_secs; }
+    if(age >= LINK_STALE_SEC) {
+        temp_text[15] = '?';
+        if(poll_now || (uint16_t)(secs - polled_at) >= LINK_HEARTBEAT_SEC) {
+            remote_poll();
+            polled_at = secs;
+            poll_now = FALSE;
+        }
+    }
+
+    while(uart_read(&c, 1)) {
+        if(!link_rx_byte(&remote_rx, c)) { continue; }
+        if(remote_rx.type != LINK_TEMP || remote_rx.len != sizeof(t)) { continue; }
+        memcpy(&t, remote_rx.payload, sizeof(t));
+        if(seen && !(t.status & LINK_ST_RESET) && (int8_t)(remote_rx.seq - last_seq) <= 0) {
+            remote_stale++;
+            continue;
+        }
+        last_seq = remote_rx.seq;
+        seen = TRUE;
+        poll_now = TRUE;                //poll again as soon as it goes stale
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { remote_age = 0; }
+        temp_text[15] = 'C';
+
+        //two places on the display, right justified, whole degrees
+        deg = (t.temp >= 0) ? (t.temp + 64) / 128 : (t.temp - 64) / 128;
+        if(!(t.status & LINK_ST_SENSOR_OK) || deg < -9 || deg > 99) {
+            temp_text[13] = '-'; temp_text[14] = '-';
+        }
+        else if(deg < 0) { temp_text[13] = '-'; temp_text[14] = '0' - deg; }
+        else if(deg < 10) { temp_text[13] = ' '; temp_text[14] = '0' + deg; }
+        else { temp_text[13] = '0' + deg / 10; temp_text[14] = '0' + deg % 10; }
+    }
+
+}//update_remote_temp
+
+
+/***********************************************************************************
+* Function: report_twi_stats
+* Parameters: always, report even if nothing moved
+* Return: none
+* Description: Logs the TWI fault counters whenever any of them 
+*   has moved since the last report. Quiet while the bus is healthy.
+*******************************************************************************/
+
+void report_twi_stats(uint8_t always) {
+    static twi_stats_t last;
+    twi_stats_t now;
+
+    twi_get_stats(&now);
+    if(!always && memcmp(&now, &last, sizeof(now)) == 0) { return; }
+    last = now;
+
+    LOG("TWI nack:%u arb:%u timeout:%u recover:%u failed:%u",
+        now.nacks, now.arb_lost, now.timeouts, now.recoveries, now.failed);
+
+}//report_twi_stats
+
+
+/***********************************************************************************
+* Function: report_uart_stats
+* Parameters: always, report even if nothing moved
+* Return: none
+* Description: Logs the USART0 receive and ATMega48 link error counters
+*   whenever any of them has moved since the last report.
+*******************************************************************************/
+
+void report_uart_stats(uint8_t always) {
+    static uart_rx_stats_t last;
+    static uint16_t last_link = 0;
+    uart_rx_stats_t now;
+    uint16_t link;
+
+    uart_get_rx_stats(&now);
+    link = remote_rx.crc_errors + remote_rx.len_errors + remote_stale;
+    if(!always && memcmp(&now, &last, sizeof(now)) == 0 && link == last_link) { return; }
+    last = now;
+    last_link = link;
+
+    LOG("USART0 rx overrun:%u framing:%u parity:%u dropped:%u link crc:%u len:%u stale:%u",
+        now.overruns, now.framing, now.parity, now.dropped,
+        remote_rx.crc_errors, remote_rx.len_errors, remote_stale);
+
+}//report_uart_stats
+
+
+/***********************************************************************************
+* Function: send_rsq_telemetry
+* Parameters: none
+* Return: none
+* Description: Logs each signal quality sample taken by the Si4734 sampler
+*   as a LOG() record, binary on the wire and queued without waiting, see
+*   log.h. Fields are as in si4734_rsq_t.
+*******************************************************************************/
+
+void send_rsq_telemetry() {
+    si4734_rsq_t rsq;
+
+    while(si4734_rsq_read(&rsq)) {
+        LOG("RSQ #%u %c %u rssi:%u snr:%u mult:%u flags:%02x", rsq.seq, "FAS"[rsq.band],
+            rsq.freq, rsq.rssi, rsq.snr, rsq.mult, rsq.flags);
+    }
+
+}//send_rsq_telemetry
+
+
+/***********************************************************************************
+* Function: measure_loop_stall
+* Parameters: none
+* Return: none
+* Description: Called every pass of the main loop. Times each pass in TIMER2
+*   ticks and, once a band switch is over, logs the longest pass seen while
+*   it ran, so the cost of a switch to the display can be checked.
+*******************************************************************************/
+
+void measure_loop_stall() {
+    static uint16_t last_tick;
+    static uint16_t worst;
+    static uint8_t switching = FALSE;
+    uint16_t now, pass;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { now = timer2_ticks; }
+    pass = now - last_tick;
+    last_tick = now;
+
+    if(radio_switching()) {
+        if(!switching) { switching = TRUE; worst = 0; return; } //pass started before the switch
+        if(pass > worst) { worst = pass; }
+        return;
+    }
+    if(!switching) { return; }
+    switching = FALSE;
+    if(pass > worst) { worst = pass; } //the pass the switch finished in
+
+    LOG("band switch, longest loop pass:%u x128us", worst);
+
+}//measure_loop_stall
+
+
+/***********************************************************************************
+* Function: restore_settings
+* Parameters: none
+* Return: none
+* Description: Loads the radio, volume and alarm settings saved in EEPROM, if
+*   there are any, over the defaults. Called once at boot.
+*******************************************************************************/
+
+void restore_settings() {
+    settings_t s;
+
+    if(!settings_load(&s)) { return; }
+    current_fm_freq = s.fm_freq;
+    current_am_freq = s.am_freq;
+    current_sw_freq = s.sw_freq;
+    volume = s.volume;
+    alarm_hrs = s.alarm_hrs;
+    alarm_min = s.alarm_min;
+    twelve_hr_format = !(s.flags & SETTINGS_24H);
+    alarm_on = (s.flags & SETTINGS_ALARM_ON) ? TRUE : FALSE;
+    alarm_AM = (s.flags & SETTINGS_ALARM_AM) ? TRUE : FALSE;
+    if(alarm_on) { memcpy(mode_text, "Normal - A Armed", 16); }
+
+}//restore_settings
+
+
+/***********************************************************************************
+* Function: save_settings
+* Parameters: none
+* Return: none
+* Description: Hands the current settings to the settings store every pass of
+*   the main loop. The store only writes them out once they stop changing,
+*   a byte at a time, so turning a knob does not wear the EEPROM.
+*******************************************************************************/
+
+void save_settings() {
+    settings_t s;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { //the encoders change these from an ISR
+        s.fm_freq = current_fm_freq;
+        s.am_freq = current_am_freq;
+        s.sw_freq = current_sw_freq;
+        s.volume = volume;
+        s.alarm_hrs = alarm_hrs;
+        s.alarm_min = alarm_min;
+        s.flags = (twelve_hr_format ? 0 : SETTINGS_24H) |
+                  (alarm_on ? SETTINGS_ALARM_ON : 0) |
+                  (alarm_AM ? SETTINGS_ALARM_AM : 0);
+    }
+    settings_update(&s);
+    settings_service();
+
+}//save_settings
+
+
+/***********************************************************************************
+* Function: report_radio_stats
+* Parameters: always, report even if nothing moved
+* Return: none
+* Description: Logs the Si4734 command and property cache counters
+*   whenever any of them has moved since the last report.
+*******************************************************************************/
+
+void report_radio_stats(uint8_t always) {
+    static si4734_stats_t last;
+    si4734_stats_t now;
+
+    si4734_get_stats(&now);
+    if(!always && memcmp(&now, &last, sizeof(now)) == 0) { return; }
+    last = now;
+
+    LOG("Si4734 cmds:%u dropped:%u cts fail:%u prop hit:%u miss:%u merged:%u",
+        now.cmds, now.dropped, now.cts_failed, now.prop_hits, now.prop_miss, now.prop_merged);
+
+}//report_radio_stats
+
+
+/***********************************************************************************
+* Functions: cmd_time, cmd_alarm, cmd_freq, cmd_band, cmd_vol, cmd_stats, cmd_help
+* Parameters: argc, argv as split by console_service(), argv[0] is the command
+* Return: none
+* Description: The UART1 console commands, see console_cmds[]. With no
+*   arguments a command logs the current value. Hours are given in the
+*   clock's own format, with am or pm after the minutes in 12 hour mode.
+*   The clock ISRs change the same variables, so they are set atomically.
+*******************************************************************************/
+
+//parses "h m [am|pm]" from argv[1] on, FALSE if it is not a valid time
+uint8_t console_clock(uint8_t argc, char **argv, int8_t *h, int8_t *m, uint8_t *am) {
+    uint16_t hh, mm;
+
+    if(argc < 3 || !console_uint(argv[1], &hh) || !console_uint(argv[2], &mm)) { return FALSE; }
+    if(mm > 59) { return FALSE; }
+    if(twelve_hr_format) {
+        if(hh < 1 || hh > 12) { return FALSE; }
+        if(argc == 4 && strcmp(argv[3], "pm") == 0) { *am = FALSE; }
+        else if(argc == 4 && strcmp(argv[3], "am") == 0) { *am = TRUE; }
+        else if(argc == 4) { return FALSE; }
+    }
+    else if(hh > 23 || argc == 4) { return FALSE; }
+    *h = hh;
+    *m = mm;
+    return TRUE;
+}//console_clock
+
+void cmd_time(uint8_t argc, char **argv) {
+    int8_t h, m;
+    uint8_t am;
+
+    if(argc > 1) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { am = AM_time; }
+        if(!console_clock(argc, argv, &h, &m, &am)) { LOG("time: h m [am|pm]"); return; }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { hrs = h; min = m; sec = 0; AM_time = am; }
+    }
+    LOG("time %u:%02u:%02u %c", hrs, min, sec, twelve_hr_format ? (AM_time ? 'A' : 'P') : ' ');
+}//cmd_time
+
+void cmd_alarm(uint8_t argc, char **argv) {
+    int8_t h, m;
+    uint8_t am = alarm_AM;
+
+    if(argc == 2 && (strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0)) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            alarm_on = (argv[1][1] == 'n');
+            if(current_mode == NORMAL && !alarm_going_off) {
+                memcpy(mode_text, alarm_on ? "Normal - A Armed" : "Normal Mode     ", 16);
+            }
+        }
+    }
+    else if(argc > 1) {
+        if(!console_clock(argc, argv, &h, &m, &am)) { LOG("alarm: h m [am|pm], on, off"); return; }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { alarm_hrs = h; alarm_min = m; alarm_AM = am; }
+    }
+    LOG("alarm %u:%02u %c %c", alarm_hrs, alarm_min,
+        twelve_hr_format ? (alarm_AM ? 'A' : 'P') : ' ', alarm_on ? '*' : '-');
+}//cmd_alarm
+
+void cmd_freq(uint8_t argc, char **argv) {
+    uint16_t f;
+
+    if(argc > 1) {
+        if(radio_switching()) { LOG("freq: band switch in progress"); return; }
+        if(!console_uint(argv[1], &f)) { LOG("freq: f, 10kHz units on FM, kHz on AM and SW"); return; }
+        switch(current_radio_band)
+        {
+            case FM:
+                if(f < FM_BAND_BOTTOM || f > FM_BAND_TOP) { LOG("freq: FM is %u to %u", FM_BAND_BOTTOM, FM_BAND_TOP); return; }
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { current_fm_freq = f; }
+                break;
+            case AM:
+                if(f < AM_BAND_BOTTOM || f > AM_BAND_TOP) { LOG("freq: AM is %u to %u", AM_BAND_BOTTOM, AM_BAND_TOP); return; }
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { current_am_freq = f; }
+                break;
+            case SW:
+                if(f < SW_BAND_BOTTOM || f > SW_BAND_TOP) { LOG("freq: SW is %u to %u", SW_BAND_BOTTOM, SW_BAND_TOP); return; }
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { current_sw_freq = f; }
+                break;
+        }//switch
+        radio_tune_request();
+        freq_disp_flag = TRUE;
+        freq_disp_counter = 0;
+    }
+    LOG("freq %c %u", "FAS"[current_radio_band],
+        current_radio_band == FM ? current_fm_freq : current_radio_band == AM ? current_am_freq : current_sw_freq);
+}//cmd_freq
+
+void cmd_band(uint8_t argc, char **argv) {
+    uint8_t band;
+
+    if(argc > 1) {
+        if(strcmp(argv[1], "fm") == 0) { band = FM; }
+        else if(strcmp(argv[1], "am") == 0) { band = AM; }
+        else if(strcmp(argv[1], "sw") == 0) { band = SW; }
+        else { LOG("band: fm, am or sw"); return; }
+        radio_band_switch(band);
+        freq_disp_flag = TRUE;
+        freq_disp_counter = 0;
+    }
+    LOG("band %c%c", "FAS"[current_radio_band], radio_switching() ? '~' : ' ');
+}//cmd_band
+
+void cmd_vol(uint8_t argc, char **argv) {
+    uint16_t v;
+
+    if(argc > 1) {
+        if(!console_uint(argv[1], &v) || v > 0x2000) { LOG("vol: 0 to %u", 0x2000); return; }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { volume = v; OCR3B = v; }
+    }
+    LOG("vol %u", volume);
+}//cmd_vol
+
+void cmd_stats(uint8_t argc, char **argv) {
+    uint16_t age, rate;
+    uint16_t entries[ISR_CNT], worst[ISR_CNT];
+    uint8_t i;
+
+    report_twi_stats(TRUE);
+    report_uart_stats(TRUE);
+    report_radio_stats(TRUE);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { age = remote_age; }
+    LOG("log dropped:%u remote frames:%u age:%u", log_dropped(), remote_rx.frames, age);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { rate = lcd_rate; }
+    LOG("LCD bytes/s:%u dropped:%u", rate, lcd_get_dropped());
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for(i = 0; i < ISR_CNT; i++) {
+            entries[i] = isr_rate[i];
+            worst[i] = isr_worst[i];
+            isr_worst[i] = 0;   //longest since this report
+        }
+    }
+    LOG("ISR entries/s t0:%u t2:%u int7:%u adc:%u",
+        entries[ISR_T0], entries[ISR_T2], entries[ISR_INT7], entries[ISR_ADC]);
+    LOG("ISR longest us t0:%u t2:%u int7:%u adc:%u",
+        worst[ISR_T0] >> 4, worst[ISR_T2] >> 4, worst[ISR_INT7] >> 4, worst[ISR_ADC] >> 4);
+}//cmd_stats
+
+void cmd_help(uint8_t argc, char **argv) {
+    LOG("commands: time [h m [am|pm]], alarm [h m [am|pm]|on|off], freq [f], band [fm|am|sw], vol [v], stats");
+}//cmd_help
+
+const console_cmd_t console_cmds[] PROGMEM = {
+    {"time",  cmd_time},
+    {"alarm", cmd_alarm},
+    {"freq",  cmd_freq},
+    {"band",  cmd_band},
+    {"vol",   cmd_vol},
+    {"stats", cmd_stats},
+    {"help",  cmd_help},
+};
+#define CONSOLE_CMDS (sizeof(console_cmds) / sizeof(console_cmds[0]))
+
+
 /***********************************************************************************
 ************************************************************************************
 *                                   Interrupt Routines                             *
@@ -762,29 +1271,63 @@ void mode_handler() {
 ***********************************************************************************/
 
 
+/***********************************************************************************
+* Function: isr_account
+* Parameters: isr, which ISR; start, TCNT3 as the ISR was entered
+* Return: none
+* Description: Called last thing in an ISR. Counts the entry and keeps the
+*   longest run, allowing for TCNT3 wrapping at OCR3A.
+*******************************************************************************/
+
+void isr_account(uint8_t isr, uint16_t start) {
+    uint16_t run = TCNT3;
+
+    if(run >= start) { run = run - start; }
+    else { run = run + 0x2001 - start; }
+    isr_entries[isr]++;
+    if(run > isr_worst[isr]) { isr_worst[isr] = run; }
+
+}//isr_account
+
+
 /***********************************************************************************
 * Description: Interrupts every second to track real time.
 ***********************************************************************************/
 ISR(TIMER0_OVF_vect) {
+    uint16_t start = TCNT3;
+    uint8_t i;
 
-    static int8_t i;
     PORTC |= (1 << PC5);
     
     step_time();
-
-    //format temp array
-    lm73_temp = (lm73_rd_buf[0] << 8) | (lm73_rd_buf[1]);
-    lm73_temp = lm73_temp >> 7;
-    itoa(lm73_temp, lm73_char_temp, 10);
-    for(i = 0; i < 2; i++)
-        temp_text[i+4] = lm73_char_temp[i];
-
-    //begin a new temp request
-    twi_start_rd(LM73_ADDRESS, lm73_rd_buf, 2);
+    settings_tick();            //ages pending settings changes toward a save
+    si4734_rsq_second();        //signal quality sample every SI4734_RSQ_SEC
+
+    //begin a new temp request, pointer write and read in one transaction.
+    //The result is picked up by update_local_temp() once it completes. Not
+    //while the last one is still on the bus or waiting to be picked up, it
+    //would land in lm73_rd_buf under update_local_temp().
+    if(!(lm73_status & (TWI_XFER_PENDING | TWI_XFER_DONE))) {
+        twi_post(LM73_ADDRESS, lm73_wr_buf, 1, lm73_rd_buf, 2, &lm73_status);
+    }
     
-    //request remote temp through uart
-    while(!(UCSR0A & (1 << UDRE0)));
-    UDR0 = 0xF0;
+    //age of the last reading from the mega48, which pushes them
+    if(remote_age != 0xFFFF) { remote_age++; }
+    remote_secs++;
+
+    //LCD traffic over the last second, for the console stats command
+    lcd_rate = lcd_get_bytes() - lcd_bytes_last;
+    lcd_bytes_last += lcd_rate;
+
+    //ISR entries over the last second, likewise
+    for(i = 0; i < ISR_CNT; i++) {
+        isr_rate[i] = isr_entries[i];
+        isr_entries[i] = 0;
+    }
+
+#if TWI_INSTRUMENT
+    if((sec % 10) == 0) { twi_dump_flag = TRUE; } //TWI latency stats every 10 sec
+#endif
 
     //track how long the radio frequency displays
     if(freq_disp_flag) {
@@ -793,6 +1336,7 @@ ISR(TIMER0_OVF_vect) {
     }
 
     PORTC &= ~(1 << PC5);
+    isr_account(ISR_T0, start);
 
 }//Timer0 overflow ISR
 
@@ -812,6 +1356,7 @@ ISR(TIMER1_COMPB_vect) {
 * Description: 
 ***********************************************************************************/
 ISR(TIMER2_OVF_vect) {
+    uint16_t start = TCNT3;
 
     PORTC |= (1 << PC3);
 
@@ -828,11 +1373,16 @@ ISR(TIMER2_OVF_vect) {
 
     refresh_lcd(lcd_display);
 
+    timer2_ticks++;             //128us time base for measure_loop_stall()
+    twi_tick();                 //time out a hung TWI transfer
+    si4734_tick();              //move queued radio commands along
+
     DDRA = old_DDRA;
     PORTA = old_PORTA;
     PORTB = old_PORTB;
 
     PORTC &= ~(1 << PC3);
+    isr_account(ISR_T2, start);
 
 }//Timer2 overflow ISR
 
@@ -843,37 +1393,22 @@ ISR(TIMER2_OVF_vect) {
 ***********************************************************************************/
 
 ISR(ADC_vect) {
+    uint16_t start = TCNT3;
 
     OCR2 = ADCH;
+    isr_account(ISR_ADC, start);
 
 }//ADC converter ISR
 
 
-/***********************************************************************************
-* Description: Received a temp byte from the ATMega48
-***********************************************************************************/
+// Interrupt for the radio, CTS and seek/tune complete edges
+ISR(INT7_vect) {
+    uint16_t start = TCNT3;
 
-ISR(USART0_RX_vect) {
+    si4734_int();
+    isr_account(ISR_INT7, start);
 
-    //PORTC |= (1 << PC4);
-
-    remote_temp = uart_getc();
-    //first or second byte?
-    if(remote_byte == 1) {
-        temp_text[13] = remote_temp;
-        remote_byte++;
-    }
-    else {
-        temp_text[14] = remote_temp;
-        remote_byte = 1;
-    }
-
-    //PORTC &= ~(1 << PC4);
-
-}//USART0 receive ISR
-
-// Interrupt for the radio
-ISR(INT7_vect) { STC_interrupt = TRUE; }
+}//INT7 ISR
 
 
 
@@ -903,6 +1438,8 @@ DDRE = (1 << PE4) | (1 << PE5) | (1 << PE6);
 // For debugging
 DDRG |= (1 << PG0) | (1 << PG1) | (1 << PG2);
 
+restore_settings();     // before timer3_init() sets the volume
+
 // initialize the real time clock and initial clock display
 real_clk_init();
 timer1_init();
@@ -915,19 +1452,24 @@ lcd_init();             // initialize the lcd screen
 clear_display();
 init_twi();
 uart_init();
+uart1_init();           // log records and the command console
 external7_interrupt_init();
 Radio_init_reset();
 
+lm73_wr_buf[0] = LM73_PTR_TEMP; //temp pointer address, sent ahead of every read
+//first reading before interrupts are on, so the temperature shows at once
+twi_post(LM73_ADDRESS, lm73_wr_buf, 1, lm73_rd_buf, 2, &lm73_status);
+twi_flush();
+update_local_temp();
+
 sei();                  // enable global interrupts
+remote_poll();          // first remote temperature, pushed by the mega48 after that
 
 fm_pwr_up();            // powerup the radio as appropriate
-current_fm_freq = 10630;
-set_property(0x4001, 0x0003);
+set_property(RX_HARD_MUTE, 0x0003);
 
 fm_tune_freq();
-
-lm73_wr_buf[0] = 0x00; //load lm72_wr_buf[0] with temp pointer address
-twi_start_wr(LM73_ADDRESS, lm73_wr_buf, 2); //start the "set-up" write
+if(!fm_stations_load()) { fm_scan_start(); } //first boot, find the stations
 
 while(1){
     //format the led display
@@ -944,10 +1486,25 @@ while(1){
             break;
     }//switch
 
+    update_local_temp();
+    update_remote_temp();
+    report_twi_stats(FALSE);
+    report_uart_stats(FALSE);
+    report_radio_stats(FALSE);
+    send_rsq_telemetry();
+    console_service(console_cmds, CONSOLE_CMDS);
+    log_service();
+    fm_stations_save();
+    save_settings();
+    measure_loop_stall();
+#if TWI_INSTRUMENT
+    if(twi_dump_flag) { twi_dump_flag = FALSE; twi_instr_dump(uart1_puts); }
+#endif
+
     //format what is sent to the lcd display 
-    for(i = 0; i < 16; i++) {
+    for(i = 0; i < LCD_COLS; i++) {
         lcd_display[i] = mode_text[i];
-        lcd_display[i+16] = temp_text[i];
+        lcd_display[i+LCD_COLS] = temp_text[i];
     }
 
     update_LEDs();
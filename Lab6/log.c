@@ -0,0 +1,78 @@
+//log.c
+//Tokenized debug log. See log.h.
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "uart_functions.h"
+#include "log.h"
+
+//framed records waiting for the UART1 ring. Filled from anywhere, ISRs
+//included, under ATOMIC_BLOCK; emptied by log_service() only.
+static uint8_t           log_ring[LOG_RING];
+static volatile uint8_t  log_head;
+static volatile uint8_t  log_tail;
+static volatile uint16_t log_lost;
+
+static inline __attribute__((always_inline)) void log_put(uint8_t *head, uint8_t byte){
+  log_ring[*head & (LOG_RING - 1)] = byte;
+  (*head)++;
+}
+
+//********************************************************************************
+//                            log_write()
+//
+//Frames one record into the ring, or counts it lost if the whole record
+//doesn't fit, so a partial record is never queued. Call through LOG().
+//
+void log_write(uint16_t id, const uint16_t *args, uint8_t n){
+  uint8_t head, len, sum, i;
+
+  if(n > LOG_MAX_ARGS){n = LOG_MAX_ARGS;}
+  len = 2 + 2 * n;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    head = log_head;
+    if((uint8_t)(LOG_RING - (uint8_t)(head - log_tail)) < len + 4){log_lost++; return;}
+    log_put(&head, LOG_SYNC);
+    log_put(&head, LOG_TYPE);
+    log_put(&head, len);
+    log_put(&head, (uint8_t)id);
+    log_put(&head, (uint8_t)(id >> 8));
+    sum = LOG_TYPE + len + (uint8_t)id + (uint8_t)(id >> 8);
+    for(i = 0; i < n; i++){
+      log_put(&head, (uint8_t)args[i]);
+      log_put(&head, (uint8_t)(args[i] >> 8));
+      sum += (uint8_t)args[i] + (uint8_t)(args[i] >> 8);
+    }
+    log_put(&head, -sum);
+    log_head = head;
+  }
+}
+
+//********************************************************************************
+//                            log_service()
+//
+//Copies as much of the ring as the UART1 transmit ring takes. Never waits.
+//
+void log_service(){
+  uint8_t head = log_head;
+  uint8_t tail = log_tail;
+  uint8_t run, sent;
+
+  while(head != tail){
+    run = LOG_RING - (tail & (LOG_RING - 1));           //up to the end of the ring
+    if(run > (uint8_t)(head - tail)){run = head - tail;}
+    sent = uart1_write(&log_ring[tail & (LOG_RING - 1)], run);
+    tail += sent;
+    log_tail = tail;
+    if(sent < run){break;}                               //UART1 ring full
+  }
+}
+
+//********************************************************************************
+//                            log_dropped()
+//
+uint16_t log_dropped(){
+  uint16_t n;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){n = log_lost;}
+  return(n);
+}
@@ -0,0 +1,40 @@
+//log.h
+//Tokenized debug log out UART1.
+//
+//  LOG("TWI nack:%u arb:%u", nacks, arb_lost);
+//
+//queues a record holding only a message ID and the arguments, as 16 bit
+//words, so it takes a few microseconds and is safe in an ISR. The format
+//string goes in the .logfmt section, which logfmt.ld keeps out of flash and
+//RAM, and the string's address in that section is its ID. logdecode.py reads
+//the strings back out of the ELF and prints the records.
+//
+//log_service() in the main loop hands queued records to uart1_write(). A
+//record goes out as
+//  LOG_SYNC LOG_TYPE len id_lo id_hi arg0_lo arg0_hi ... sum
+//where len counts the ID and argument bytes and sum makes the bytes after
+//LOG_SYNC add up to zero.
+//
+//Arguments are promoted to 16 bits, so formats use %d %u %x %c only.
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+#define LOG_SYNC      0xA5
+#define LOG_TYPE      0x02
+#define LOG_MAX_ARGS  8
+#define LOG_RING      128  //bytes, must be a power of two, 128 at most
+
+#define LOG(fmt, ...) do { \
+  static const char _log_fmt[] __attribute__((section(".logfmt"), used)) = fmt; \
+  const uint16_t _log_args[] = {__VA_ARGS__}; \
+  log_write((uint16_t)(uintptr_t)_log_fmt, _log_args, sizeof(_log_args) / sizeof(uint16_t)); \
+} while(0)
+
+void     log_write(uint16_t id, const uint16_t *args, uint8_t n);
+void     log_service();      //main loop, moves records to the UART1 ring
+uint16_t log_dropped();      //records lost to a full ring
+
+#endif //LOG_H
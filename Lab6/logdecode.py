@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+# logdecode.py
+# Prints the UART1 stream of the alarm clock: tokenized LOG() records (log.h)
+# rendered with the format strings read out of the ELF, and any plain text
+# as is.
+#
+#   python3 logdecode.py lab6.elf /dev/ttyUSB0
+#   python3 logdecode.py lab6.elf capture.bin
+#
+# Set the port to 250000 8N1 raw first, e.g. stty -F /dev/ttyUSB0 250000 raw
+# The ELF must be the one on the chip, message IDs change with every build.
+# On a port, lines typed on stdin go to the console (console.h), try help.
+
+import os
+import re
+import stat
+import struct
+import sys
+import threading
+
+SYNC = 0xA5
+TYPE_LOG = 0x02
+LOG_MAX = 2 + 2 * 8   # LOG_MAX_ARGS
+
+CONV = re.compile(r"%[-+ 0#]*\d*(?:\.\d+)?(?:hh|h|l)?([diuxXc%])")
+
+
+def logfmt_strings(path):
+    """Returns {id: format} from the .logfmt section of an ELF file."""
+    with open(path, "rb") as f:
+        elf = f.read()
+    if elf[:4] != b"\x7fELF":
+        sys.exit("%s is not an ELF file" % path)
+    is64 = elf[4] == 2
+    if is64:
+        shoff, = struct.unpack_from("<Q", elf, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x3A)
+    else:
+        shoff, = struct.unpack_from("<I", elf, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x2E)
+
+    def section(i):
+        off = shoff + i * shentsize
+        if is64:
+            name, _, _, addr, offset, size = struct.unpack_from("<IIQQQQ", elf, off)
+        else:
+            name, _, _, addr, offset, size = struct.unpack_from("<IIIIII", elf, off)
+        return name, addr, offset, size
+
+    _, _, stroff, _ = section(shstrndx)
+    for i in range(shnum):
+        name, addr, offset, size = section(i)
+        end = elf.index(b"\0", stroff + name)
+        if elf[stroff + name:end] == b".logfmt":
+            break
+    else:
+        sys.exit("%s has no .logfmt section, built without logfmt.ld?" % path)
+
+    strings = {}
+    data = elf[offset:offset + size]
+    i = 0
+    while i < len(data):
+        if data[i] == 0:       # alignment padding
+            i += 1
+            continue
+        end = data.index(b"\0", i)
+        strings[addr + i] = data[i:end].decode("latin-1")
+        i = end + 1
+    return strings
+
+
+def render(fmt, args):
+    args = list(args)
+
+    def conv(m):
+        if m.group(1) == "%":
+            return "%"
+        if not args:
+            return "<?>"
+        v = args.pop(0)
+        spec = m.group(0)
+        spec = re.sub(r"(hh|h|l)(?=[diuxXc]$)", "", spec)
+        if m.group(1) in "di":
+            v = v - 0x10000 if v & 0x8000 else v
+        elif m.group(1) == "c":
+            v = chr(v & 0xFF)
+        return spec % v
+
+    return CONV.sub(conv, fmt)
+
+
+def decode(strings, stream, out):
+    buf = b""
+    while True:
+        chunk = stream.read(1)
+        if not chunk:
+            out.write(buf.decode("latin-1"))
+            return
+        buf += chunk
+        while buf:
+            if buf[0] != SYNC:
+                out.write(chr(buf[0]))
+                buf = buf[1:]
+                continue
+            if len(buf) < 3:
+                break
+            if buf[1] == TYPE_LOG and 2 <= buf[2] <= LOG_MAX and buf[2] % 2 == 0:
+                need = 4 + buf[2]
+            else:
+                need = 0
+            if need and len(buf) < need:
+                break
+            if not need or sum(buf[1:need]) & 0xFF:
+                out.write(chr(buf[0]))  # not a record, or a damaged one
+                buf = buf[1:]
+                continue
+            rec, buf = buf[1:need], buf[need:]
+            n = rec[1]
+            mid, = struct.unpack_from("<H", rec, 2)
+            args = struct.unpack_from("<%dH" % ((n - 2) // 2), rec, 4)
+            fmt = strings.get(mid)
+            if fmt is None:
+                out.write("<log id %u %s, wrong ELF?>\n" % (mid, list(args)))
+            else:
+                out.write(render(fmt, args) + "\n")
+            out.flush()
+
+
+def console(port):
+    """Sends each line from stdin to the console, CR terminated."""
+    with open(port, "wb", buffering=0) as out:
+        for line in sys.stdin:
+            out.write(line.rstrip("\r\n").encode("latin-1") + b"\r")
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: logdecode.py lab6.elf port_or_capture")
+    strings = logfmt_strings(sys.argv[1])
+    if stat.S_ISCHR(os.stat(sys.argv[2]).st_mode):
+        threading.Thread(target=console, args=(sys.argv[2],), daemon=True).start()
+    with open(sys.argv[2], "rb", buffering=0) as stream:
+        try:
+            decode(strings, stream, sys.stdout)
+        except KeyboardInterrupt:
+            pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,65 @@
+//remote_link.h
+//Framing for the USART0 link between the mega128 alarm clock and the
+//Mega48 remote temperature node. The same file is used on both ends
+//(Lab6 and Lab5/Mega48), keep the copies identical.
+//
+//A frame is
+//  LINK_SYNC len type seq payload[len] crc
+//crc is the CRC-8 (_crc8_ccitt_update, starting from 0) of len, type, seq
+//and the payload. seq counts the frames each end sends. Multibyte fields
+//are little endian. A receiver hunts for LINK_SYNC, and drops anything
+//that is too long or fails the CRC and hunts again.
+
+#ifndef REMOTE_LINK_H
+#define REMOTE_LINK_H
+
+#include <stdint.h>
+
+#define LINK_SYNC     0x7E
+#define LINK_MAX      8     //longest payload
+#define LINK_OVERHEAD 5     //sync, len, type, seq, crc
+
+//frame types
+#define LINK_POLL     0x01  //mega128 -> Mega48, send a LINK_TEMP now, no payload
+#define LINK_TEMP     0x02  //Mega48 -> mega128, link_temp_t
+
+//Push mode. The Mega48 sends a LINK_TEMP on its own when the temperature
+//has moved more than LINK_PUSH_DELTA from the last one sent, and at least
+//every LINK_HEARTBEAT_SEC. The mega128 takes a reading older than
+//LINK_STALE_SEC as stale, and polls then. Override in DEFS if wanted.
+#ifndef LINK_PUSH_DELTA
+#define LINK_PUSH_DELTA    64  //LM73 units, 1/128 C, so half a degree
+#endif
+#ifndef LINK_HEARTBEAT_SEC
+#define LINK_HEARTBEAT_SEC 10
+#endif
+#define LINK_STALE_SEC     (2 * LINK_HEARTBEAT_SEC + 5) //two heartbeats missed
+
+//link_temp_t status bits
+#define LINK_ST_SENSOR_OK 0x01  //the LM73 read that gave temp worked
+#define LINK_ST_RESET     0x02  //first frame since the node reset, seq restarts
+
+typedef struct {
+  int16_t  temp;    //LM73 temperature register, degrees C * 128
+  uint16_t time;    //node uptime in seconds when temp was read
+  uint8_t  status;  //LINK_ST_*
+} __attribute__((packed)) link_temp_t;
+
+//receiver state, one per link
+typedef struct {
+  uint8_t state;
+  uint8_t len;
+  uint8_t idx;
+  uint8_t crc;
+  uint8_t type;               //of the last good frame
+  uint8_t seq;
+  uint8_t payload[LINK_MAX];
+  uint16_t frames;            //good frames
+  uint16_t crc_errors;        //frames dropped for a bad CRC
+  uint16_t len_errors;        //frames dropped for a bad length
+} link_rx_t;
+
+uint8_t link_frame(uint8_t *frame, uint8_t type, uint8_t seq, const void *payload, uint8_t len);
+uint8_t link_rx_byte(link_rx_t *rx, uint8_t byte);
+
+#endif //REMOTE_LINK_H
@@ -0,0 +1,130 @@
+//settings.c
+//Wear leveled, write-behind settings store in EEPROM. See settings.h.
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include <stddef.h>
+#include <string.h>
+#include "settings.h"
+
+#define FALSE 0
+#define TRUE  1
+
+//what goes into a slot
+typedef struct {
+  uint8_t    seq;      //one more than the record before, wraps
+  uint8_t    version;  //SETTINGS_VERSION
+  settings_t data;
+  uint8_t    crc;      //CRC-8 of the bytes above, written last
+} settings_rec_t;
+
+static settings_rec_t settings_eeprom[SETTINGS_SLOTS] EEMEM;
+
+static settings_t       settings_cur;      //as of the last settings_update()
+static uint8_t          settings_dirty;    //settings_cur not saved yet
+static volatile uint8_t settings_quiet;    //seconds since settings_cur changed
+static settings_rec_t   settings_out;      //newest record, saved or being written
+static uint8_t          settings_out_idx = sizeof(settings_rec_t); //next byte to write
+static uint8_t          settings_slot;     //slot the next record goes in
+
+//********************************************************************************
+//                            settings_crc()
+//
+static uint8_t settings_crc(const settings_rec_t *rec){
+  const uint8_t *p = (const uint8_t *)rec;
+  uint8_t crc = 0;
+  uint8_t i;
+
+  for(i = 0; i < offsetof(settings_rec_t, crc); i++){crc = _crc8_ccitt_update(crc, p[i]);}
+  return(crc);
+}
+
+//********************************************************************************
+//                            settings_load()
+//
+//Reads every slot once and keeps the newest record with a good CRC and the
+//current version. Sequence numbers are compared as a signed difference so
+//the wrap from 255 to 0 still orders them; the slots in use never span
+//more than SETTINGS_SLOTS numbers. Returns FALSE, leaving *s alone, if no
+//slot holds a good record (first boot, or a new SETTINGS_VERSION).
+//
+uint8_t settings_load(settings_t *s){
+  settings_rec_t rec;
+  uint8_t        i, found = FALSE;
+
+  for(i = 0; i < SETTINGS_SLOTS; i++){
+    eeprom_read_block(&rec, &settings_eeprom[i], sizeof(rec));
+    if(rec.version != SETTINGS_VERSION || rec.crc != settings_crc(&rec)){continue;}
+    if(found && (int8_t)(rec.seq - settings_out.seq) <= 0){continue;}
+    settings_out  = rec;
+    settings_slot = i;
+    found = TRUE;
+  }
+  if(!found){
+    memset(&settings_out, 0, sizeof(settings_out));
+    settings_slot = 0;
+    return(FALSE);
+  }
+  settings_slot = (settings_slot + 1) % SETTINGS_SLOTS;
+  settings_cur  = settings_out.data;
+  *s = settings_cur;
+  return(TRUE);
+}
+
+//********************************************************************************
+//                            settings_update()
+//
+//Takes the settings as they are now. Cheap when nothing changed, so it can
+//be called every pass of the main loop. A change restarts the quiet time.
+//
+void settings_update(const settings_t *s){
+  if(memcmp(s, &settings_cur, sizeof(settings_cur)) == 0){return;}
+  settings_cur   = *s;
+  settings_dirty = TRUE;
+  settings_quiet = 0;
+}
+
+//********************************************************************************
+//                            settings_tick()
+//
+void settings_tick(){
+  if(settings_quiet != 0xFF){settings_quiet++;}
+}
+
+//********************************************************************************
+//                            settings_service()
+//
+//Writes one byte of a pending record when the EEPROM is free, so the main
+//loop never waits out the 3.4ms byte write. A record is started once the
+//settings have been left alone for SETTINGS_QUIET_SEC and differ from the
+//newest one saved.
+//
+void settings_service(){
+  uint8_t *dst;
+
+  if(settings_out_idx == sizeof(settings_out)){ //nothing being written
+    if(!settings_dirty || settings_quiet < SETTINGS_QUIET_SEC){return;}
+    settings_dirty = FALSE;
+    if(memcmp(&settings_cur, &settings_out.data, sizeof(settings_cur)) == 0){return;} //changed back
+    settings_out.seq++;
+    settings_out.version = SETTINGS_VERSION;
+    settings_out.data    = settings_cur;
+    settings_out.crc     = settings_crc(&settings_out);
+    settings_out_idx     = 0;
+  }
+  if(!eeprom_is_ready()){return;}
+
+  dst = (uint8_t *)&settings_eeprom[settings_slot];
+  eeprom_update_byte(dst + settings_out_idx, ((uint8_t *)&settings_out)[settings_out_idx]);
+  if(++settings_out_idx == sizeof(settings_out)){
+    settings_slot = (settings_slot + 1) % SETTINGS_SLOTS;
+  }
+}
+
+//********************************************************************************
+//                            settings_saving()
+//
+uint8_t settings_saving(){
+  return(settings_dirty || (settings_out_idx != sizeof(settings_out)));
+}
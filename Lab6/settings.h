@@ -0,0 +1,45 @@
+//settings.h
+//Alarm clock settings kept in EEPROM across power cycles.
+//
+//Each save writes the whole record, with a sequence number and CRC-8, into
+//the next of SETTINGS_SLOTS slots, round-robin, so wear is spread over the
+//region and a save cut short by a power loss leaves the previous record in
+//place. settings_load() scans the slots once at boot for the newest record
+//that checks out.
+//
+//Saves are write-behind: settings_update() only notes a change, and the
+//record goes out SETTINGS_QUIET_SEC seconds after the last one, a byte per
+//settings_service() call, so spinning a knob costs one save, not one per
+//detent, and the main loop never waits on the EEPROM.
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stdint.h>
+
+#define SETTINGS_VERSION    1   //bump when settings_t changes
+#define SETTINGS_SLOTS      16  //records in the wear leveled region
+#define SETTINGS_QUIET_SEC  5   //seconds without a change before saving
+
+//settings_t flags
+#define SETTINGS_24H        0x01  //24 hour clock
+#define SETTINGS_ALARM_ON   0x02  //alarm armed
+#define SETTINGS_ALARM_AM   0x04  //12 hour alarm time is AM
+
+typedef struct {
+  uint16_t fm_freq;    //10khz units
+  uint16_t am_freq;    //khz
+  uint16_t sw_freq;    //khz
+  uint16_t volume;     //OCR3B duty cycle
+  int8_t   alarm_hrs;
+  int8_t   alarm_min;
+  uint8_t  flags;
+} settings_t;
+
+uint8_t settings_load(settings_t *s);          //TRUE if a saved record was found
+void    settings_update(const settings_t *s);  //note the current settings
+void    settings_service();                    //main loop, writes a pending save
+void    settings_tick();                       //call once a second
+uint8_t settings_saving();                     //TRUE until a pending save is written
+
+#endif //SETTINGS_H
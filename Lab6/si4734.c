@@ -1,52 +1,362 @@
 //Si4734 i2C functions     
 //Roger Traylor 11.13.2011
 //device driver for the si4734 chip.
-//TODO: unify the properties if possible between modes
-//TODO: unify power up commands...all 0x01?, think so, power ups look the same
-//TODO: document how this is now running with interrupt mode
-//      and not blind timing. 
+//Commands are queued and run by a small engine driven from the INT7 (CTS and
+//STC edges) and TIMER2 interrupts, see si4734_run(). Nothing here waits on
+//the chip. The properties the driver sets are cached across all bands and
+//saved and restored per band by a band switch, see radio_band_switch().
+//POWER_UP is the same command byte in every mode, only its arguments and the
+//properties set after it differ.
 
 // header files
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include <stdlib.h>
+#include <string.h>
 #include <util/twi.h>
 #include <avr/eeprom.h>
 #include <util/delay.h>
-#include "uart_functions.h"
+#include <util/atomic.h>
 
 #include "twi_master.h" //my defines for TWCR_START, STOP, RACK, RNACK, SEND
 #include "si4734.h"
+#include "log.h"
 
-uint8_t si4734_wr_buf[9];          //buffer for holding data to send to the si4734 
 uint8_t si4734_rd_buf[15];         //buffer for holding data recieved from the si4734
 uint8_t si4734_tune_status_buf[8]; //buffer for holding tune_status data  
 uint8_t si4734_revision_buf[16];   //buffer for holding revision  data  
 
-enum radio_band{FM, AM, SW};
-
 volatile uint8_t STC_interrupt;  //flag bit to indicate tune or seek is done
 
+//command engine states
+enum si4734_state{SI_IDLE, SI_SEND, SI_WAIT_CTS, SI_READ, SI_STATUS};
+
+//one queued command
+typedef struct {
+  uint8_t  cmd[SI4734_CMD_MAX];  //command byte and arguments
+  uint8_t  cmd_cnt;
+  uint8_t  *resp;                //response, status byte first, NULL if not wanted
+  uint8_t  resp_cnt;
+  uint16_t cts_ticks;            //longest the command can run, in si4734_tick()s
+  volatile uint8_t *done;        //set TRUE when finished, ok or not, may be NULL
+} si4734_cmd_t;
+
+static si4734_cmd_t     si4734_queue[SI4734_QUEUE_SIZE];
+static volatile uint8_t si4734_q_head;      //next free slot
+static volatile uint8_t si4734_q_tail;      //command being worked on
+static volatile uint8_t si4734_q_sent;      //the tail command has gone out to the chip
+static volatile uint8_t si4734_state = SI_IDLE;
+static volatile uint8_t si4734_twi_status;  //TWI_XFER_* of our transfer on the bus
+static volatile uint8_t si4734_int_seen;    //INT edge since the command was sent
+static volatile uint16_t si4734_timer;      //ticks spent waiting for CTS
+static uint16_t         si4734_wait;        //ticks to wait before reading anyway
+static uint8_t          si4734_polls;       //status reads that found CTS low
+static uint8_t          si4734_status;      //status byte, when no response is wanted
+static si4734_stats_t   si4734_stats;
+
+//properties the driver sets, and the value last set for each
+static const uint16_t si4734_props[SI4734_PROP_CNT] =
+  {GPO_IEN, RX_HARD_MUTE, AM_CHANNEL_FILTER, AM_SOFT_MUTE_MAX_ATTENUATION};
+static uint16_t si4734_prop_val[SI4734_PROP_CNT];
+static uint8_t  si4734_prop_valid;  //bit per property, value known
+static uint8_t  si4734_prop_after;  //bit per property, set behind the last queued power command
+static uint8_t  si4734_pwr_queued;  //POWER_UP/POWER_DOWN queued, not yet retired
+
+static volatile uint8_t  si4734_tune_pending; //radio_tune_request() not yet acted on
+static volatile uint16_t si4734_tune_quiet;   //ticks since the last request
+
+//band switch, and the band properties of each band as it was last left
+enum si4734_band_state{BAND_IDLE, BAND_DOWN, BAND_UP};
+
+#define SI4734_BAND_PROPS 0x0C //si4734_props[] bits: AM_CHANNEL_FILTER, AM_SOFT_MUTE_MAX_ATTENUATION
+#define SI4734_MUTE_PROP  0x02 //si4734_props[] bit: RX_HARD_MUTE
+
+static volatile uint8_t si4734_band_state = BAND_IDLE;
+static uint16_t         si4734_band_val[SI4734_BANDS][SI4734_PROP_CNT];
+static uint8_t          si4734_band_valid[SI4734_BANDS];
+static uint16_t         si4734_band_mute;     //RX_HARD_MUTE to carry over
+static uint8_t          si4734_band_mute_valid;
+
+//band scan
+enum fm_scan_state{SCAN_OFF, SCAN_START, SCAN_SEEK, SCAN_STATUS};
+
+static volatile uint8_t si4734_scan_state = SCAN_OFF;
+static volatile uint8_t si4734_scan_done;     //tune status read is over
+static uint16_t         si4734_scan_return;   //frequency to go back to
+static si4734_station_t si4734_stations[SI4734_STATIONS];
+static volatile uint8_t si4734_station_cnt;
+static uint8_t          si4734_station_idx;   //last station stepped to
+static volatile uint8_t si4734_stations_dirty;//table changed since saved
+
+static uint8_t          eeprom_station_cnt EEMEM;
+static si4734_station_t eeprom_stations[SI4734_STATIONS] EEMEM;
+
+#define SI4734_SAVE_IDLE 0xFF                 //si4734_save_idx with no save going
+static si4734_station_t si4734_save_buf[SI4734_STATIONS]; //table being written
+static uint8_t          si4734_save_cnt;      //stations in it
+static uint8_t          si4734_save_idx = SI4734_SAVE_IDLE; //next byte, count byte last
+
+//signal quality sampler
+static si4734_rsq_t     si4734_rsq_ring[SI4734_RSQ_RING];
+static volatile uint8_t si4734_rsq_head;      //next slot to fill, ISR side
+static volatile uint8_t si4734_rsq_tail;      //next slot to read, main loop side
+static volatile uint8_t si4734_rsq_secs;      //seconds since the last sample
+static volatile uint8_t si4734_rsq_due;       //a sample is wanted
+static volatile uint8_t si4734_rsq_done = TRUE; //RSQ_STATUS answered
+static uint8_t          si4734_rsq_buf[8];    //its response
+static si4734_rsq_t     si4734_rsq_next;      //sample being taken
+static uint8_t          si4734_rsq_seq;
+
+//revision read, see get_rev()
+static volatile uint8_t si4734_rev_done;      //GET_REV answered
+static volatile uint8_t si4734_rev_wanted;    //asked for, not logged yet
+
+static void fm_scan_step();
+static void si4734_rsq_step();
+static void si4734_rev_step();
+static void radio_band_step();
+static void radio_tune();
 
 //******************************************************************
 
+//********************************************************************************
+//                            si4734_pwr_cmd()
+//
+//TRUE for the commands that put the chip back to its property defaults.
+//
+static uint8_t si4734_pwr_cmd(uint8_t cmd){
+  return(cmd == FM_PWR_UP || cmd == PWR_DOWN); //AM_PWR_UP is the same byte
+}
+
+//********************************************************************************
+//                            si4734_retire()
+//
+//Done with the command at the tail, successfully or not. Once a power
+//command is over the chip is back to its defaults, bar the properties
+//queued behind the last power command.
+//
+static void si4734_retire(){
+  si4734_cmd_t *cmd = &si4734_queue[si4734_q_tail];
+
+  if(cmd->done){*(cmd->done) = TRUE;}
+  if(si4734_pwr_cmd(cmd->cmd[0])){
+    si4734_pwr_queued--;
+    si4734_prop_valid &= si4734_prop_after;
+  }
+  si4734_q_tail = (si4734_q_tail + 1) & (SI4734_QUEUE_SIZE - 1);
+  si4734_q_sent = FALSE;
+  si4734_state = SI_IDLE;
+}
+
+//********************************************************************************
+//                            si4734_run()
+//
+//The command engine. Each command is written, then CTS is waited for, then
+//the status byte (and the response, if one is wanted) is read back. With
+//CTSIEN set the chip pulses INT as CTS comes up, so the read goes out on
+//that edge. If the edge never comes the read goes out anyway once the
+//command's datasheet time has passed. A status read that still shows CTS
+//low is repeated every SI4734_CTS_POLL_TICKS, a few times at most.
+//An INT edge while idle is a tune or seek finishing (STCINT); the status
+//byte is read to confirm it before STC_interrupt is set.
+//Runs from the INT7 and TIMER2 ISRs, and from si4734_cmd() with interrupts
+//off, never waits on anything.
+//
+static void si4734_run(){
+  si4734_cmd_t *cmd = &si4734_queue[si4734_q_tail];
+  uint8_t      *resp;
+  uint8_t      resp_cnt;
+
+  if(cmd->resp_cnt){resp = cmd->resp; resp_cnt = cmd->resp_cnt;}
+  else             {resp = &si4734_status; resp_cnt = 1;}
+
+  switch(si4734_state){
+    case SI_IDLE:
+      if(si4734_int_seen){   //tune or seek done, go and look
+        if(twi_post(SI4734_ADDRESS | TW_READ, &si4734_status, 1, NULL, 0, &si4734_twi_status)){
+          si4734_int_seen = FALSE;
+          si4734_state = SI_STATUS;
+        }
+        break;
+      }
+      if(si4734_q_head == si4734_q_tail){break;} //nothing to do
+      if(!twi_post(SI4734_ADDRESS, cmd->cmd, cmd->cmd_cnt, NULL, 0, &si4734_twi_status)){break;} //TWI queue full, next tick
+      si4734_q_sent = TRUE;
+      if(cmd->cmd[0] == FM_TUNE_FREQ || cmd->cmd[0] == AM_TUNE_FREQ ||
+         cmd->cmd[0] == FM_SEEK_START){STC_interrupt = FALSE;}
+      si4734_int_seen = FALSE;
+      si4734_state = SI_SEND;
+      break;
+    case SI_SEND:
+      if(!(si4734_twi_status & TWI_XFER_DONE)){break;}
+      if(si4734_twi_status & TWI_XFER_ERROR){si4734_stats.twi_errors++; si4734_retire(); si4734_run(); break;}
+      si4734_timer = 0;
+      si4734_wait  = cmd->cts_ticks;
+      si4734_polls = 0;
+      si4734_state = SI_WAIT_CTS;
+      //fall through, CTS may already have come up
+    case SI_WAIT_CTS:
+      if(!si4734_int_seen && (si4734_timer < si4734_wait)){break;}
+      if(!twi_post(SI4734_ADDRESS | TW_READ, resp, resp_cnt, NULL, 0, &si4734_twi_status)){break;}
+      si4734_int_seen = FALSE;
+      si4734_state = SI_READ;
+      break;
+    case SI_READ:
+      if(!(si4734_twi_status & TWI_XFER_DONE)){break;}
+      if((si4734_twi_status & TWI_XFER_ERROR) || !(resp[0] & SI4734_STATUS_CTS)){
+        if(++si4734_polls >= SI4734_CTS_TRIES){si4734_stats.cts_failed++; si4734_retire(); si4734_run(); break;}
+        si4734_stats.cts_polls++;
+        si4734_timer = 0;
+        si4734_wait  = SI4734_CTS_POLL_TICKS; //not yet, look again shortly
+        si4734_state = SI_WAIT_CTS;
+        break;
+      }
+      if(resp[0] & SI4734_STATUS_STCINT){STC_interrupt = TRUE;}
+      si4734_stats.cmds++;
+      si4734_retire();
+      si4734_run();  //on to the next one
+      break;
+    case SI_STATUS:
+      if(!(si4734_twi_status & TWI_XFER_DONE)){break;}
+      if(!(si4734_twi_status & TWI_XFER_ERROR) && (si4734_status & SI4734_STATUS_STCINT)){STC_interrupt = TRUE;}
+      si4734_state = SI_IDLE;
+      si4734_run();
+      break;
+  }//switch
+}
+//********************************************************************************
+
+//********************************************************************************
+//                            si4734_cmd()
+//
+//Queues a command for the engine and returns at once. The command bytes are
+//copied. resp, if not NULL, is filled with resp_cnt bytes once the command
+//is done. cts_ticks is the longest the command can take. *done, if not
+//NULL, goes TRUE when the command is over; resp[0] then shows CTS if it
+//worked. Safe to call from an ISR. Returns FALSE if the queue is full and
+//the command was dropped.
+//
+static uint8_t si4734_cmd(uint8_t *wr_buf, uint8_t cmd_cnt, uint8_t *resp,
+                          uint8_t resp_cnt, uint16_t cts_ticks, volatile uint8_t *done){
+  uint8_t      next, i;
+  si4734_cmd_t *cmd;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    next = (si4734_q_head + 1) & (SI4734_QUEUE_SIZE - 1);
+    if(next == si4734_q_tail){si4734_stats.dropped++; return(FALSE);}
+    cmd = &si4734_queue[si4734_q_head];
+    for(i = 0; i < cmd_cnt; i++){cmd->cmd[i] = wr_buf[i];}
+    cmd->cmd_cnt   = cmd_cnt;
+    cmd->resp      = resp;
+    cmd->resp_cnt  = resp_cnt;
+    cmd->cts_ticks = cts_ticks;
+    cmd->done      = done;
+    if(done){*done = FALSE;}
+    si4734_q_head  = next;
+    if(si4734_pwr_cmd(wr_buf[0])){
+      si4734_pwr_queued++;
+      si4734_prop_after = 0;   //defaults again once it has run
+    }
+    si4734_run();   //start it if the engine is idle
+  }
+  return(TRUE);
+}
+//********************************************************************************
+
+//********************************************************************************
+//                            si4734_prop_merge()
+//
+//Looks for a SET_PROPERTY of the same property that has not gone out yet
+//and gives it the new value. Returns TRUE if one was found. Only the tail
+//can have been sent; while the engine is only reading an STC status it has
+//not, and can still be changed. Only commands behind the last queued power
+//command count, a value written before a power cycle does not last through
+//it. Call with interrupts off.
+//
+static uint8_t si4734_prop_merge(uint16_t property, uint16_t property_value){
+  uint8_t      i = si4734_q_tail;
+  si4734_cmd_t *cmd;
+  si4734_cmd_t *found = NULL;
+
+  if(si4734_q_sent){i = (i + 1) & (SI4734_QUEUE_SIZE - 1);} //tail is on its way
+  for(; i != si4734_q_head; i = (i + 1) & (SI4734_QUEUE_SIZE - 1)){
+    cmd = &si4734_queue[i];
+    if(si4734_pwr_cmd(cmd->cmd[0])){found = NULL;} //start again past it
+    else if(cmd->cmd[0] == SET_PROPERTY && cmd->cmd[2] == (uint8_t)(property >> 8) &&
+            cmd->cmd[3] == (uint8_t)(property)){found = cmd;}
+  }
+  if(!found){return(FALSE);}
+  found->cmd[4] = (uint8_t)(property_value >> 8);
+  found->cmd[5] = (uint8_t)(property_value);
+  return(TRUE);
+}
+//********************************************************************************
+
+//********************************************************************************
+//                            si4734_int()
+//
+//Call from ISR(INT7_vect). GPO2/INT pulses when CTS comes up and when a
+//tune or seek completes.
+//
+void si4734_int(){
+  si4734_int_seen = TRUE;
+  si4734_run();
+}
+
+//********************************************************************************
+//                            si4734_tick()
+//
+//Call from a periodic timer interrupt, every SI4734_TICK_US. Times CTS and
+//picks up finished TWI transfers.
+//
+void si4734_tick(){
+  if(si4734_timer != 0xFFFF){si4734_timer++;}
+  fm_scan_step();
+  radio_band_step();
+  si4734_rsq_step();
+  si4734_rev_step();
+  if(si4734_tune_pending && si4734_band_state == BAND_IDLE){
+    if(si4734_tune_quiet != 0xFFFF){si4734_tune_quiet++;}
+    if(STC_interrupt || (si4734_tune_quiet >= SI4734_TUNE_QUIET_TICKS)){
+      si4734_tune_pending = FALSE;
+      radio_tune();           //to wherever the requests have got to
+    }
+  }
+  si4734_run();
+}
+
+//********************************************************************************
+//                            si4734_busy()
+//
+//TRUE while commands are queued or being worked on.
+//
+uint8_t si4734_busy(){
+  return((si4734_q_head != si4734_q_tail) || (si4734_state != SI_IDLE));
+}
+
+//********************************************************************************
+//                            si4734_get_stats()
+//
+void si4734_get_stats(si4734_stats_t *stats){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    *stats = si4734_stats;
+  }
+}
+//********************************************************************************
+
 
 //********************************************************************************
 //                            get_int_status()
 //
-//Fetch the interrupt status available from the status byte.
+//Fetch the interrupt status available from the status byte. It lands in
+//si4734_rd_buf[0] once si4734_busy() goes FALSE.
 //
-//TODO: update for interrupts
 // 
-uint8_t get_int_status(){
+void get_int_status(){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
 
     si4734_wr_buf[0] = GET_INT_STATUS;              
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 1); //send get_int_status command
-    while( twi_busy() ){}; //spin while previous TWI transaction finshes
-    _delay_us(300);        //si4734 process delay
-    twi_start_rd(SI4734_ADDRESS, si4734_rd_buf, 1); //get the interrupt status 
-    while( twi_busy() ){}; //spin while previous TWI transaction finshes
-    return(si4734_rd_buf[0]);
+    si4734_cmd(si4734_wr_buf, 1, si4734_rd_buf, 1, SI4734_CTS_TICKS, NULL); //send get_int_status, get the interrupt status 
 }
 //********************************************************************************
 
@@ -54,9 +364,10 @@ uint8_t get_int_status(){
 //                            fm_tune_freq()
 //
 //takes current_fm_freq and sends it to the radio chip
-//
+//STC_interrupt goes TRUE when the tune completes.
 
 void fm_tune_freq(){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
   si4734_wr_buf[0] = 0x20;  //fm tune command
   si4734_wr_buf[1] = 0x00;  //no FREEZE and no FAST tune
   si4734_wr_buf[2] = (uint8_t)(current_fm_freq >> 8); //freq high byte
@@ -64,8 +375,374 @@ void fm_tune_freq(){
   si4734_wr_buf[4] = 0x00;  //antenna tuning capactior
   //send fm tune command
   STC_interrupt = FALSE;
-  twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 5);
- //while( ! STC_interrupt ){}; //spin until the tune command finishes 
+  si4734_cmd(si4734_wr_buf, 5, NULL, 0, SI4734_CTS_TICKS, NULL);
+}
+//********************************************************************************
+
+//********************************************************************************
+//                            radio_tune_request()
+//
+//Asks for a tune to the current band's frequency without sending it yet,
+//for the tuning knob. See SI4734_TUNE_QUIET_TICKS. Safe to call from an ISR.
+//
+
+void radio_tune_request(){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    if(si4734_tune_pending){si4734_stats.tune_merged++;}
+    si4734_tune_pending = TRUE;
+    si4734_tune_quiet = 0;
+  }
+}
+//********************************************************************************
+
+//********************************************************************************
+//                            si4734_rsq_second()
+//
+//Call once a second, e.g. from the real time clock ISR.
+//
+void si4734_rsq_second(){
+  if(++si4734_rsq_secs >= SI4734_RSQ_SEC){
+    si4734_rsq_secs = 0;
+    si4734_rsq_due  = TRUE;
+  }
+}
+
+//********************************************************************************
+//                            si4734_rsq_step()
+//
+//Sampler, run from si4734_tick(). Queues the RSQ_STATUS when a sample is due
+//and files the answer in the ring once the engine has it. Skipped while the
+//band is changing, when the chip is powered down.
+//
+static void si4734_rsq_step(){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
+  uint8_t *buf = si4734_rsq_buf;
+  uint8_t head = si4734_rsq_head;
+  uint8_t next;
+
+  if(!si4734_rsq_done){return;}
+  if(si4734_rsq_next.seq != si4734_rsq_seq){  //answer is in
+    si4734_rsq_seq = si4734_rsq_next.seq;
+    if(!(buf[0] & SI4734_STATUS_CTS)){return;}
+    si4734_rsq_next.rssi  = buf[4];
+    si4734_rsq_next.snr   = buf[5];
+    si4734_rsq_next.mult  = (si4734_rsq_next.band == FM) ? buf[6] : 0;
+    si4734_rsq_next.flags = (buf[2] & (RSQ_STATUS_VALID | RSQ_STATUS_SOFTMUTE)) |
+                            ((si4734_rsq_next.band == FM) ? (buf[3] & FM_RSQ_STATUS_PILOT) : 0);
+    next = (head + 1) & (SI4734_RSQ_RING - 1);
+    if(next == si4734_rsq_tail){return;}        //main loop is behind, drop it
+    si4734_rsq_ring[head] = si4734_rsq_next;
+    si4734_rsq_head = next;
+    return;
+  }
+  if(!si4734_rsq_due || si4734_band_state != BAND_IDLE){return;}
+  si4734_rsq_due = FALSE;
+
+  si4734_rsq_next.band = current_radio_band;
+  switch(current_radio_band){
+    case FM: si4734_rsq_next.freq = current_fm_freq; si4734_wr_buf[0] = FM_RSQ_STATUS; break;
+    case AM: si4734_rsq_next.freq = current_am_freq; si4734_wr_buf[0] = AM_RSQ_STATUS; break;
+    case SW: si4734_rsq_next.freq = current_sw_freq; si4734_wr_buf[0] = AM_RSQ_STATUS; break;
+  }
+  si4734_wr_buf[1] = 0x00;  //leave the RSQ interrupt flags alone
+  if(si4734_cmd(si4734_wr_buf, 2, buf, 8, SI4734_CTS_TICKS, &si4734_rsq_done)){
+    si4734_rsq_next.seq = si4734_rsq_seq + 1;
+  }
+}
+
+//********************************************************************************
+//                            si4734_rsq_read()
+//
+//Takes the oldest sample from the ring. Returns FALSE if there is none.
+//Main loop only, it is the one reader.
+//
+uint8_t si4734_rsq_read(si4734_rsq_t *rsq){
+  uint8_t tail = si4734_rsq_tail;
+
+  if(tail == si4734_rsq_head){return(FALSE);}
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){*rsq = si4734_rsq_ring[tail];} //barrier, the slot is ours
+  si4734_rsq_tail = (tail + 1) & (SI4734_RSQ_RING - 1);
+  return(TRUE);
+}
+
+//********************************************************************************
+//                            radio_tune()
+//
+//Tunes to the frequency kept for the current band.
+//
+static void radio_tune(){
+  switch(current_radio_band){
+    case FM: fm_tune_freq(); break;
+    case AM: am_tune_freq(); break;
+    case SW: sw_tune_freq(); break;
+  }
+}
+
+//********************************************************************************
+//                            radio_band_switch()
+//
+//Starts a switch to band, see si4734.h. Does nothing if the radio is
+//already there or on its way somewhere. Safe to call from an ISR.
+//
+void radio_band_switch(uint8_t band){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
+  uint8_t old = current_radio_band;
+  uint8_t i;
+
+  if(band >= SI4734_BANDS || band == old || si4734_band_state != BAND_IDLE){return;}
+  fm_scan_stop();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    //keep the band's properties before POWER_DOWN forgets them
+    for(i = 0; i < SI4734_PROP_CNT; i++){si4734_band_val[old][i] = si4734_prop_val[i];}
+    si4734_band_valid[old] = si4734_prop_valid & SI4734_BAND_PROPS;
+    si4734_band_mute       = si4734_prop_val[1];
+    si4734_band_mute_valid = si4734_prop_valid & SI4734_MUTE_PROP;
+    si4734_tune_pending    = FALSE;
+    current_radio_band     = band;
+    si4734_band_state      = BAND_DOWN;
+    si4734_wr_buf[0] = PWR_DOWN;
+    si4734_cmd(si4734_wr_buf, 1, NULL, 0, SI4734_CTS_TICKS, NULL);
+  }
+}
+
+uint8_t radio_switching(){return(si4734_band_state != BAND_IDLE);}
+
+//********************************************************************************
+//                            radio_band_step()
+//
+//Band switch state machine, run from si4734_tick(). Each step goes once
+//the command queue has drained, so the queue never holds more than one
+//step's worth.
+//
+static void radio_band_step(){
+  uint8_t band = current_radio_band;
+  uint8_t i;
+
+  if(si4734_band_state == BAND_IDLE || si4734_busy()){return;}
+  switch(si4734_band_state){
+    case BAND_DOWN:
+      switch(band){
+        case FM: fm_pwr_up(); break;
+        case AM: am_pwr_up(); break;
+        case SW: sw_pwr_up(); break;
+      }
+      si4734_band_state = BAND_UP;
+      break;
+    case BAND_UP:
+      for(i = 0; i < SI4734_PROP_CNT; i++){
+        if(si4734_band_valid[band] & (1 << i)){set_property(si4734_props[i], si4734_band_val[band][i]);}
+      }
+      if(si4734_band_mute_valid){set_property(RX_HARD_MUTE, si4734_band_mute);}
+      radio_tune();
+      si4734_band_state = BAND_IDLE;
+      break;
+  }//switch
+}
+
+//********************************************************************************
+//                            fm_seek_up()
+//
+//Seeks up to the next valid station, stopping at FM_SEEK_BAND_TOP.
+//
+static void fm_seek_up(){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
+
+  si4734_wr_buf[0] = FM_SEEK_START;
+  si4734_wr_buf[1] = FM_SEEK_UP;   //no wrap, BLTF tells us we are done
+  STC_interrupt = FALSE;
+  si4734_cmd(si4734_wr_buf, 2, NULL, 0, SI4734_CTS_TICKS, NULL);
+}
+
+//********************************************************************************
+//                            fm_station_add()
+//
+//Files a station found by the scan, in frequency order. With the table full
+//it takes the place of the weakest station, if it is stronger.
+//
+static void fm_station_add(uint16_t freq, uint8_t rssi){
+  uint8_t chan = (uint8_t)((freq - FM_CHAN_BASE) / 10);
+  uint8_t i, weakest = 0;
+
+  if(si4734_station_cnt == SI4734_STATIONS){
+    for(i = 1; i < SI4734_STATIONS; i++){
+      if(si4734_stations[i].rssi < si4734_stations[weakest].rssi){weakest = i;}
+    }
+    if(rssi <= si4734_stations[weakest].rssi){return;}
+    for(i = weakest; i < SI4734_STATIONS - 1; i++){si4734_stations[i] = si4734_stations[i + 1];}
+    si4734_station_cnt--;
+  }
+  for(i = si4734_station_cnt; i > 0 && si4734_stations[i - 1].chan > chan; i--){
+    si4734_stations[i] = si4734_stations[i - 1];
+  }
+  si4734_stations[i].chan = chan;
+  si4734_stations[i].rssi = rssi;
+  si4734_station_cnt++;
+}
+
+//********************************************************************************
+//                            fm_scan_step()
+//
+//Band scan state machine, run from si4734_tick(). Each seek ends in an STC,
+//after which FM_TUNE_STATUS gives the frequency, RSSI and whether the seek
+//ran into the top of the band.
+//
+static void fm_scan_step(){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
+  uint8_t *buf = si4734_tune_status_buf;
+
+  switch(si4734_scan_state){
+    case SCAN_OFF:
+      break;
+    case SCAN_START:   //parked just below the band, go
+    case SCAN_SEEK:
+      //the engine clears STC_interrupt as it sends a tune or seek, so with
+      //nothing left queued it is the STC of the one last sent
+      if(!STC_interrupt || si4734_busy()){break;}
+      if(si4734_scan_state == SCAN_START){fm_seek_up(); si4734_scan_state = SCAN_SEEK; break;}
+      si4734_wr_buf[0] = FM_TUNE_STATUS;
+      si4734_wr_buf[1] = FM_TUNE_STATUS_IN_INTACK;
+      if(si4734_cmd(si4734_wr_buf, 2, buf, 8, SI4734_CTS_TICKS, &si4734_scan_done)){
+        si4734_scan_state = SCAN_STATUS;
+      }
+      break;
+    case SCAN_STATUS:
+      if(!si4734_scan_done){break;}
+      if(!(buf[0] & SI4734_STATUS_CTS)){fm_scan_stop(); break;} //chip not answering
+      //past the last station the seek stops on the band edge, already seen
+      if(buf[1] & FM_TUNE_STATUS_BLTF){fm_scan_stop(); break;}
+      if(buf[1] & FM_TUNE_STATUS_VALID){
+        fm_station_add(((uint16_t)buf[2] << 8) | buf[3], buf[4]);
+      }
+      fm_seek_up();
+      si4734_scan_state = SCAN_SEEK;
+      break;
+  }//switch
+}
+
+//********************************************************************************
+//                            fm_scan_start()
+//
+//Rebuilds the station table by seeking through the band in the background.
+//The radio goes back to the current frequency when the scan is done.
+//
+void fm_scan_start(){
+  if(si4734_scan_state != SCAN_OFF || current_radio_band != FM || si4734_band_state != BAND_IDLE){return;}
+  si4734_tune_pending = FALSE;
+  si4734_scan_return  = current_fm_freq;
+  si4734_station_cnt  = 0;
+  set_property(FM_SEEK_BAND_BOTTOM, FM_BAND_BOTTOM);
+  set_property(FM_SEEK_BAND_TOP, FM_BAND_TOP);
+  set_property(FM_SEEK_FREQ_SPACING, FM_BAND_SPACING);
+  current_fm_freq = FM_BAND_BOTTOM - FM_BAND_SPACING; //so the first seek lands on the bottom
+  fm_tune_freq();
+  current_fm_freq = si4734_scan_return;
+  si4734_scan_state = SCAN_START;
+}
+
+//********************************************************************************
+//                            fm_scan_stop()
+//
+//Ends a scan, keeping what was found, and tunes back.
+//
+void fm_scan_stop(){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    if(si4734_scan_state != SCAN_OFF){
+      si4734_scan_state = SCAN_OFF;
+      si4734_stations_dirty = TRUE;
+      fm_tune_freq();
+    }
+  }
+}
+
+uint8_t fm_scanning(){return(si4734_scan_state != SCAN_OFF);}
+
+//********************************************************************************
+//                            fm_station_step()
+//
+//Moves current_fm_freq dir stations up or down the table, wrapping around,
+//and asks for the tune. From a station it is a plain index step; off one
+//it goes to the nearest station in that direction. Returns FALSE, doing
+//nothing, if there is no table yet. Stops a scan that is running.
+//
+uint8_t fm_station_step(int8_t dir){
+  uint8_t cnt = si4734_station_cnt;
+  uint8_t idx = si4734_station_idx;
+  uint8_t chan, i;
+
+  if(si4734_scan_state != SCAN_OFF){fm_scan_stop();}
+  if(cnt == 0 || dir == 0){return(FALSE);}
+  chan = (uint8_t)((current_fm_freq - FM_CHAN_BASE) / 10);
+
+  if(idx >= cnt || si4734_stations[idx].chan != chan){ //not on a station
+    for(i = 0; i < cnt && si4734_stations[i].chan < chan; i++){};
+    if(dir > 0){idx = (i < cnt && si4734_stations[i].chan == chan) ? i + 1 : i;}
+    else       {idx = i ? i - 1 : cnt - 1;}
+    if(idx >= cnt){idx = 0;}
+  }
+  else if(dir > 0){idx = (idx + 1 < cnt) ? idx + 1 : 0;}
+  else            {idx = idx ? idx - 1 : cnt - 1;}
+
+  si4734_station_idx = idx;
+  current_fm_freq = FM_CHAN_BASE + 10 * (uint16_t)si4734_stations[idx].chan;
+  radio_tune_request();
+  return(TRUE);
+}
+
+//********************************************************************************
+//                            fm_stations_load()
+//
+//Reads the station table back from EEPROM at boot. Returns the number of
+//stations, zero if none were saved.
+//
+uint8_t fm_stations_load(){
+  uint8_t cnt = eeprom_read_byte(&eeprom_station_cnt);
+
+  if(cnt > SI4734_STATIONS){cnt = 0;} //erased or never written
+  eeprom_read_block(si4734_stations, eeprom_stations, cnt * sizeof(si4734_station_t));
+  si4734_station_cnt = cnt;
+  return(cnt);
+}
+
+//********************************************************************************
+//                            fm_stations_save()
+//
+//Writes the station table to EEPROM if a scan has changed it, one byte per
+//call when the EEPROM is free, so the main loop never waits out the 3.4ms
+//byte write. The count goes last, after the stations it covers. Call it
+//every pass of the main loop, not from an ISR.
+//
+void fm_stations_save(){
+  uint8_t len;
+
+  if(si4734_save_idx == SI4734_SAVE_IDLE){         //nothing being written
+    if(!si4734_stations_dirty){return;}
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+      si4734_stations_dirty = FALSE;
+      si4734_save_cnt = si4734_station_cnt;
+      memcpy(si4734_save_buf, si4734_stations, sizeof(si4734_save_buf));
+    }
+    si4734_save_idx = 0;
+  }
+  if(!eeprom_is_ready()){return;}
+
+  len = si4734_save_cnt * sizeof(si4734_station_t);
+  if(si4734_save_idx < len){
+    eeprom_update_byte((uint8_t *)eeprom_stations + si4734_save_idx,
+                       ((uint8_t *)si4734_save_buf)[si4734_save_idx]);
+    si4734_save_idx++;
+    return;
+  }
+  eeprom_update_byte(&eeprom_station_cnt, si4734_save_cnt);
+  si4734_save_idx = SI4734_SAVE_IDLE;
+}
+
+//********************************************************************************
+//                            fm_stations_saving()
+//
+//TRUE until a changed station table has been written out.
+//
+uint8_t fm_stations_saving(){
+  return(si4734_stations_dirty || (si4734_save_idx != SI4734_SAVE_IDLE));
 }
 //********************************************************************************
 
@@ -73,9 +750,10 @@ void fm_tune_freq(){
 //                            am_tune_freq()
 //
 //takes current_am_freq and sends it to the radio chip
-//
+//STC_interrupt goes TRUE when the tune completes.
 
 void am_tune_freq(){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
   si4734_wr_buf[0] = AM_TUNE_FREQ; //am tune command
   si4734_wr_buf[1] = 0x00;         //no FAST tune
   si4734_wr_buf[2] = (uint8_t)(current_am_freq >> 8); //freq high byte
@@ -84,8 +762,7 @@ void am_tune_freq(){
   si4734_wr_buf[5] = 0x00;  //antenna tuning capactior low byte
   //send am tune command
   STC_interrupt = FALSE;
-  twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 6);
-  while( ! STC_interrupt ){}; //spin until the tune command finishes 
+  si4734_cmd(si4734_wr_buf, 6, NULL, 0, SI4734_CTS_TICKS, NULL);
 }
 //********************************************************************************
 
@@ -94,8 +771,10 @@ void am_tune_freq(){
 //
 //takes current_sw_freq and sends it to the radio chip
 //antcap low byte is 0x01 as per datasheet
+//STC_interrupt goes TRUE when the tune completes.
 
 void sw_tune_freq(){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
   si4734_wr_buf[0] = 0x40;  //am tune command
   si4734_wr_buf[1] = 0x00;  //no FAST tune
   si4734_wr_buf[2] = (uint8_t)(current_sw_freq >> 8); //freq high byte
@@ -103,27 +782,25 @@ void sw_tune_freq(){
   si4734_wr_buf[4] = 0x00;  //antenna tuning capactior high byte
   si4734_wr_buf[5] = 0x01;  //antenna tuning capactior low byte 
   //send am tune command
-  twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 6);
-   _delay_ms(80); //TODO: FIX
+  STC_interrupt = FALSE;
+  si4734_cmd(si4734_wr_buf, 6, NULL, 0, SI4734_CTS_TICKS, NULL);
 }
 
 //********************************************************************************
 //                            fm_pwr_up()
 //
 void fm_pwr_up(){
-//restore the previous fm frequency  
- //current_fm_freq = eeprom_read_word(&eeprom_fm_freq); //TODO: only this one does not work 
- //current_volume  = eeprom_read_byte(&eeprom_volume); //TODO: only this one does not work 
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
 
 //send fm power up command
   si4734_wr_buf[0] = FM_PWR_UP; //powerup command byte
-  si4734_wr_buf[1] = 0x50;      //GPO2O enabled, STCINT enabled, use ext. 32khz osc.
+  si4734_wr_buf[1] = 0xD0;      //CTS interrupt, GPO2O enabled, use ext. 32khz osc.
   si4734_wr_buf[2] = 0x05;      //OPMODE = 0x05; analog audio output
-  twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 3);
-  _delay_ms(170);               //startup delay as specified 
+  si4734_cmd(si4734_wr_buf, 3, NULL, 0, SI4734_PWR_UP_TICKS, NULL);
   //The seek/tune interrupt is enabled here. If the STCINT bit is set, a 1.5us
   //low pulse will be output from GPIO2/INT when tune or seek is completed.
-  set_property(GPO_IEN, GPO_IEN_STCIEN); //seek_tune complete interrupt
+  //CTS keeps its interrupt too, it drives the command engine.
+  set_property(GPO_IEN, GPO_IEN_STCIEN | GPO_IEN_CTSIEN); //seek_tune complete interrupt
 }
 //********************************************************************************
 
@@ -131,17 +808,14 @@ void fm_pwr_up(){
 //                            am_pwr_up()
 //
 void am_pwr_up(){
-//restore the previous am frequency  
-  current_am_freq = eeprom_read_word(&eeprom_am_freq);
-  current_volume  = eeprom_read_byte(&eeprom_volume); //TODO: only this one does not work 
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
 
 //send am power up command
   si4734_wr_buf[0] = AM_PWR_UP;
-  si4734_wr_buf[1] = 0x51;//GPO2OEN and XOSCEN selected
+  si4734_wr_buf[1] = 0xD1;//CTSIEN, GPO2OEN and XOSCEN selected
   si4734_wr_buf[2] = 0x05;
-  twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 3);
-  _delay_ms(120);   
-  set_property(GPO_IEN, GPO_IEN_STCIEN);    //Seek/Tune Complete interrupt
+  si4734_cmd(si4734_wr_buf, 3, NULL, 0, SI4734_PWR_UP_TICKS, NULL);
+  set_property(GPO_IEN, GPO_IEN_STCIEN | GPO_IEN_CTSIEN);    //Seek/Tune Complete interrupt
 }
 //********************************************************************************
 
@@ -150,22 +824,19 @@ void am_pwr_up(){
 //
 
 void sw_pwr_up(){
-//restore the previous sw frequency  
-  current_sw_freq = eeprom_read_word(&eeprom_sw_freq);
-  current_volume  = eeprom_read_byte(&eeprom_volume); //TODO: only this one does not work 
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
 
 //send sw power up command (same as am, only tuning rate is different)
     si4734_wr_buf[0] = AM_PWR_UP; //same cmd as for AM
-    si4734_wr_buf[1] = 0x51;
+    si4734_wr_buf[1] = 0xD1;
     si4734_wr_buf[2] = 0x05;
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 3);
-    _delay_ms(120);   //start up delay
+    si4734_cmd(si4734_wr_buf, 3, NULL, 0, SI4734_PWR_UP_TICKS, NULL);
 
   //set property to disable soft muting for shortwave broadcasts
   set_property(AM_SOFT_MUTE_MAX_ATTENUATION, 0x0000); //cut off soft mute  
   //select 4khz filter BW and engage power line filter
   set_property(AM_CHANNEL_FILTER, (AM_CHFILT_4KHZ | AM_PWR_LINE_NOISE_REJT_FILTER)); 
-  set_property(GPO_IEN, GPO_IEN_STCIEN); //Seek/Tune Complete interrupt
+  set_property(GPO_IEN, GPO_IEN_STCIEN | GPO_IEN_CTSIEN); //Seek/Tune Complete interrupt
 }
 //********************************************************************************
 
@@ -174,23 +845,11 @@ void sw_pwr_up(){
 //
 
 void radio_pwr_dwn(){
-
-/*
-//save current frequency to EEPROM
-switch(current_radio_band){
-  case(FM) : eeprom_write_word(&eeprom_fm_freq, current_fm_freq); break;
-  case(AM) : eeprom_write_word(&eeprom_am_freq, current_am_freq); break;
-  case(SW) : eeprom_write_word(&eeprom_sw_freq, current_sw_freq); break;
-  default  : break;
-}//switch      
-
-  eeprom_write_byte(&eeprom_volume, current_volume); //save current volume level
-*/
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
 
 //send fm power down command
     si4734_wr_buf[0] = 0x11;
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 1);
-   _delay_us(310); //power down delay
+    si4734_cmd(si4734_wr_buf, 1, NULL, 0, SI4734_CTS_TICKS, NULL);
 }
 //********************************************************************************
 
@@ -201,20 +860,13 @@ switch(current_radio_band){
 //(RSSI), signal to noise ratio (SNR), and other info. This function sets the
 //FM_RSQ_STATUS_IN_INTACK bit so it clears RSQINT and some other interrupt flags
 //inside the chip. 
-//TODO: Dang, thats a big delay, could cause problems, best check out.
 //
 void fm_rsq_status(){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
 
     si4734_wr_buf[0] = FM_RSQ_STATUS;            //fm_rsq_status command
     si4734_wr_buf[1] = FM_RSQ_STATUS_IN_INTACK;  //clear STCINT bit if set
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 2);
-    while(twi_busy()){}; //spin while previous TWI transaction finshes
-    _delay_us(300);      //delay for si4734 to process
-    //This is a blind wait. Waiting for CTS interrupt here would tell you 
-    //when the command is received and has been processed.
-    //get the fm tune status 
-    twi_start_rd(SI4734_ADDRESS, si4734_tune_status_buf, 8);
-    while(twi_busy()){}; //spin while previous TWI transaction finshes
+    si4734_cmd(si4734_wr_buf, 2, si4734_tune_status_buf, 8, SI4734_CTS_TICKS, NULL); //get the fm rsq status
 }
 
 
@@ -224,60 +876,53 @@ void fm_rsq_status(){
 //Get the status following a fm_tune_freq command. Returns the current frequency,
 //RSSI, SNR, multipath and antenna capacitance value. The STCINT interrupt bit
 //is cleared.
-//TODO: Dang, thats a big delay, could cause problems, best check out.
 //
 void fm_tune_status(){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
 
     si4734_wr_buf[0] = FM_TUNE_STATUS;            //fm_tune_status command
     si4734_wr_buf[1] = FM_TUNE_STATUS_IN_INTACK;  //clear STCINT bit if set
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 2);
-    while(twi_busy()){}; //spin while previous TWI transaction finshes
-    _delay_us(300);        //delay for si4734 to process
-    //get the fm tune status 
-    twi_start_rd(SI4734_ADDRESS, si4734_tune_status_buf, 8);
-    while( twi_busy() ){}; //spin till TWI read transaction finshes
+    si4734_cmd(si4734_wr_buf, 2, si4734_tune_status_buf, 8, SI4734_CTS_TICKS, NULL); //get the fm tune status
 }
 
 //********************************************************************************
 //                            am_tune_status()
 //
-//TODO: could probably just have one tune_status() function
-//TODO: Dang, thats a big delay, could cause problems, best check out.
+//As fm_tune_status(), for AM and SW. The response lands in the same
+//si4734_tune_status_buf, with the frequency and RSSI in the same bytes.
 
 void am_tune_status(){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
 
-    si4734_wr_buf[0] = AM_TUNE_STATUS;            //fm_tune_status command
+    si4734_wr_buf[0] = AM_TUNE_STATUS;            //am_tune_status command
     si4734_wr_buf[1] = AM_TUNE_STATUS_IN_INTACK;  //clear STCINT bit if set
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 2);
-    while(twi_busy()){}; //spin while previous TWI transaction finshes
-    _delay_us(300);        //delay for si4734 to process command
-    //get the am tune status 
-    twi_start_rd(SI4734_ADDRESS, si4734_tune_status_buf, 8);
+    si4734_cmd(si4734_wr_buf, 2, si4734_tune_status_buf, 8, SI4734_CTS_TICKS, NULL); //get the am tune status
 
 }
 //********************************************************************************
 //                            am_rsq_status()
 //
-//TODO: Dang, thats a big delay, could cause problems, best check out.
 
 void am_rsq_status(){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
 
     si4734_wr_buf[0] = AM_RSQ_STATUS;            //am_rsq_status command
     si4734_wr_buf[1] = AM_RSQ_STATUS_IN_INTACK;  //clear STCINT bit if set
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 2);
-    while(twi_busy()){}; //spin while previous TWI transaction finshes
-    _delay_us(300);        //delay for si4734 to process command
-    //get the fm tune status 
-    twi_start_rd(SI4734_ADDRESS, si4734_tune_status_buf, 8);
+    si4734_cmd(si4734_wr_buf, 2, si4734_tune_status_buf, 8, SI4734_CTS_TICKS, NULL); //get the am rsq status
 }
 
 //********************************************************************************
 //                            set_property()
 //
-//The set property command does not have a indication that it has completed. This
-//command is guarnteed by design to finish in 10ms. 
+//The set property command is guarnteed by design to finish in 10ms. It is
+//queued like any other command and CTS shows when it is done, so this
+//returns at once and is safe to call from an ISR. Writes that would not
+//change anything are dropped, and writes made while an earlier one for
+//the same property is still waiting in the queue are folded into it.
 //
 void set_property(uint16_t property, uint16_t property_value){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
+  uint8_t i, known;
 
     si4734_wr_buf[0] = SET_PROPERTY;                   //set property command
     si4734_wr_buf[1] = 0x00;                           //all zeros
@@ -285,52 +930,62 @@ void set_property(uint16_t property, uint16_t property_value){
     si4734_wr_buf[3] = (uint8_t)(property);            //property low byte
     si4734_wr_buf[4] = (uint8_t)(property_value >> 8); //property value high byte
     si4734_wr_buf[5] = (uint8_t)(property_value);      //property value low byte
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 6);
-    _delay_ms(10);  //SET_PROPERTY command takes 10ms to complete
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+      for(i = 0; i < SI4734_PROP_CNT; i++){
+        if(si4734_props[i] == property){break;}
+      }
+      if(i < SI4734_PROP_CNT){
+        //with a power command queued only values set behind it will hold
+        known = si4734_prop_valid;
+        if(si4734_pwr_queued){known &= si4734_prop_after;}
+        if((known & (1 << i)) && si4734_prop_val[i] == property_value){
+          si4734_stats.prop_hits++;
+          return;               //already set, or about to be
+        }
+        si4734_prop_val[i] = property_value;
+        si4734_prop_valid |= (1 << i);
+        si4734_prop_after |= (1 << i);
+      }
+      if(si4734_prop_merge(property, property_value)){
+        si4734_stats.prop_merged++;
+        return;                 //rides on the one already queued
+      }
+      si4734_stats.prop_miss++;
+      if(!si4734_cmd(si4734_wr_buf, 6, NULL, 0, SI4734_PROP_TICKS, NULL) && i < SI4734_PROP_CNT){
+        si4734_prop_valid &= ~(1 << i);  //lost, do not trust the shadow
+        si4734_prop_after &= ~(1 << i);
+      }
+    }
 }//set_property()
 
 //********************************************************************************
 //                            get_rev()
 //
-//TODO: UNTESTED!
-//Report the chip revision info via uart1. UART1 be setup and connected to 
-//a dumb terminal. e.g.: screen /dev/cu.usbserial-A800fh27 9600
+//Asks for the chip revision info. It lands in si4734_revision_buf and is
+//logged by si4734_tick() once it is in, see log.h. Read it with logdecode.py.
 //
 void get_rev(){
+  uint8_t si4734_wr_buf[SI4734_CMD_MAX];
     si4734_wr_buf[0] = GET_REV;                   //get rev command 
-    twi_start_wr(SI4734_ADDRESS, si4734_wr_buf, 1);
-    while( twi_busy() ){}; //spin till TWI read transaction finshes
-    _delay_us(300);        //wait for processing delay
-//get the revision info  
-    twi_start_rd(SI4734_ADDRESS, si4734_revision_buf, 8);
-    while( twi_busy() ){}; //spin till TWI read transaction finshes
-//use TABs instead?
-    uart1_puts("Si4734 Rev:  last 2 digits of part no.   chip rev     \n\r");
-    uart1_puts("             -------------------------   --------     \n\r");
-    uart1_puts("                          "); itoa((int)si4734_revision_buf[1], uart1_tx_buf, 10); uart1_puts(uart1_tx_buf); 
-    uart1_puts("             "); itoa((int)si4734_revision_buf[2], uart1_tx_buf, 10); uart1_puts(uart1_tx_buf); uart1_puts("\n\r");
-}
-
-//********************************************************************************
-//                          get_fm_rsq_status()
-//
-// TODO: UNTESTED!
-//Report the fm rsq status via uart1. Requires that UART1 be setup and connected to 
-//a terminal. e.g.: screen /dev/cu.usbserial-A800fh27 9600
-//Also requires that a fm_tune_status has been previously called.
-
-void get_fm_rsq_status(){
-  uint8_t disp_freq;  //temp holding variable
-  char    str[40];    //temp for building strings
-
-  uart1_puts("FM_RSQ_STATUS: ");
-  uart1_puts("status byte   :");   itoa((int)si4734_tune_status_buf[0], uart1_tx_buf, 16);   uart1_puts(uart1_tx_buf); uart1_puts("\n\r");
-  uart1_puts("resp1         :");   itoa((int)si4734_tune_status_buf[1], uart1_tx_buf, 10);   uart1_puts(uart1_tx_buf); uart1_puts("\n\r");
-  disp_freq = si4734_tune_status_buf[2];      //load high frequency byte
-  disp_freq = (disp_freq << 8); //shift upper byte to upper 8 bits
-  disp_freq |= si4734_tune_status_buf[3];     //load low high frequency byte
-  uart1_puts("freq          :");   itoa(disp_freq, uart1_tx_buf, 10);   uart1_puts(uart1_tx_buf); uart1_puts("\n\r");
-  uart1_puts("freq high     :");   itoa((int)si4734_tune_status_buf[2], str, 16);   uart1_puts(str); uart1_puts("\n\r");
-  uart1_puts("freq low      :");   itoa((int)si4734_tune_status_buf[3], str, 16);   uart1_puts(str); uart1_puts("\n\r");
-  uart1_puts("rssi          :");   itoa((int)si4734_tune_status_buf[4], uart1_tx_buf, 16);   uart1_puts(uart1_tx_buf); uart1_puts("\n\r");
+    if(si4734_cmd(si4734_wr_buf, 1, si4734_revision_buf, 9, SI4734_CTS_TICKS, &si4734_rev_done)){
+      si4734_rev_wanted = TRUE;
+    }
 }
+
+//********************************************************************************
+//                            si4734_rev_step()
+//
+//Logs the revision asked for by get_rev() once the engine has read it.
+//Run from si4734_tick().
+//
+static void si4734_rev_step(){
+  uint8_t *buf = si4734_revision_buf;
+
+  if(!si4734_rev_wanted || !si4734_rev_done){return;}
+  si4734_rev_wanted = FALSE;
+  if(!(buf[0] & SI4734_STATUS_CTS)){return;} //chip not answering
+  LOG("Si4734 Rev: part no. last 2 digits:%u firmware:%c%c chip rev:%c",
+      buf[1], buf[2], buf[3], buf[8]);
+}
+
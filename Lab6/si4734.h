@@ -14,9 +14,15 @@
 #define AM_CHFILT_2KHZ                0x0003
 #define AM_CHFILT_1KHZ                0x0004
 #define RX_HARD_MUTE                  0x4001
+#define FM_SEEK_BAND_BOTTOM           0x1400
+#define FM_SEEK_BAND_TOP              0x1401
+#define FM_SEEK_FREQ_SPACING          0x1402
 
 //command definitions
 #define FM_TUNE_FREQ    0x20
+#define FM_SEEK_START   0x21
+#define FM_SEEK_UP      0x08  //FM_SEEK_START ARG1, seek up
+#define FM_SEEK_WRAP    0x04  //FM_SEEK_START ARG1, wrap at the band limit
 #define FM_PWR_UP       0x01
 #define AM_PWR_UP       0x01
 #define AM_TUNE_FREQ    0x40
@@ -25,36 +31,153 @@
 #define GET_INT_STATUS  0x14
 #define FM_TUNE_STATUS_IN_INTACK 0x01
 #define FM_TUNE_STATUS  0x22
+#define FM_TUNE_STATUS_BLTF  0x80  //RESP1, seek hit the band limit
+#define FM_TUNE_STATUS_VALID 0x01  //RESP1, channel is a valid station
 #define FM_RSQ_STATUS_IN_INTACK 0x01
 #define FM_RSQ_STATUS   0x23
+#define RSQ_STATUS_SOFTMUTE  0x08  //RESP2, soft mute engaged
+#define RSQ_STATUS_VALID     0x01  //RESP2, channel is a valid station
+#define FM_RSQ_STATUS_PILOT  0x80  //RESP3, stereo pilot present
 #define AM_TUNE_STATUS_IN_INTACK 0x01
 #define AM_TUNE_STATUS  0x42
 #define AM_RSQ_STATUS   0x43
 #define AM_RSQ_STATUS_IN_INTACK 0x01
 #define GET_REV         0x10 
 
+//status byte returned first in every response
+#define SI4734_STATUS_CTS    0x80  //clear to send, response is valid
+#define SI4734_STATUS_STCINT 0x01  //seek/tune complete
+#define SI4734_CTS_TRIES     10    //response re-reads before giving up on CTS
+
+//Command engine. Commands are queued and sent one at a time; the next one
+//goes out once CTS is back. si4734_tick() runs every SI4734_TICK_US (TIMER2).
+//The *_TICKS times are the datasheet maximums, used only if the CTS
+//interrupt does not come.
+#define SI4734_QUEUE_SIZE      8    //queued commands, must be a power of two
+#define SI4734_CMD_MAX         6    //command plus arguments, longest is AM_TUNE_FREQ
+#define SI4734_TICK_US         128
+#define SI4734_CTS_TICKS       8    //most commands, 300us
+#define SI4734_PROP_TICKS      79   //SET_PROPERTY, 10ms
+#define SI4734_PWR_UP_TICKS    1329 //POWER_UP, 110ms plus crystal start, 170ms
+#define SI4734_CTS_POLL_TICKS  8    //between status reads while CTS is low
+
+//Property cache. The last value set for each property in si4734_props[]
+//is kept so a write of the same value again is skipped. A write that
+//changes a value still waiting in the queue replaces it there instead of
+//adding a second SET_PROPERTY, but never one queued ahead of a POWER_UP or
+//POWER_DOWN. Once either has run everything set ahead of it is forgotten.
+#define SI4734_PROP_CNT        4    //properties cached
+
+//Tune coalescing. radio_tune_request() only marks a tune to the current
+//band's frequency as wanted. si4734_tick() sends it once the tune before it has finished (STC),
+//or once requests have stopped for SI4734_TUNE_QUIET_TICKS in case the STC
+//never came. Requests made meanwhile fold into the one tune.
+#define SI4734_TUNE_QUIET_TICKS 625 //80ms, longer than any tune takes
+
+//Bands as the tuning knob covers them. FM in 10khz units, AM and SW in khz.
+#define FM_BAND_BOTTOM  8890
+#define FM_BAND_TOP     10790
+#define FM_BAND_SPACING 20
+#define AM_BAND_BOTTOM  520
+#define AM_BAND_TOP     1710
+#define AM_BAND_SPACING 10
+#define SW_BAND_BOTTOM  2300
+#define SW_BAND_TOP     23000
+#define SW_BAND_SPACING 5
+
+//Band switching. radio_band_switch() queues the POWER_DOWN and returns;
+//si4734_tick() powers up in the new band once the chip is down, then puts
+//back the band's own properties, as they were when the band was last
+//left, and tunes to its frequency. The hard mute carries over. Commands
+//and tune requests for the old band should wait for radio_switching().
+enum radio_band{FM, AM, SW};
+#define SI4734_BANDS    3
+
+//Signal quality sampler. Every SI4734_RSQ_SEC calls of si4734_rsq_second()
+//an FM_RSQ_STATUS (AM_RSQ_STATUS on AM and SW) is queued, and its answer
+//is put in a ring of SI4734_RSQ_RING samples for the main loop to take
+//with si4734_rsq_read(). Nothing waits on the chip. A full ring drops the
+//new sample; the gap shows in seq.
+#define SI4734_RSQ_SEC  5    //seconds between samples
+#define SI4734_RSQ_RING 8    //samples kept, must be a power of two
+
+//si4734_rsq_t flags
+#define RSQ_VALID       0x01 //RSQ_STATUS_VALID
+#define RSQ_SOFTMUTE    0x08 //RSQ_STATUS_SOFTMUTE
+#define RSQ_STEREO      0x80 //FM stereo pilot
+
+typedef struct {
+  uint8_t  seq;     //counts samples taken, wraps
+  uint8_t  band;    //enum radio_band
+  uint16_t freq;    //frequency tuned when sampled
+  uint8_t  rssi;    //dBuV
+  uint8_t  snr;     //dB
+  uint8_t  mult;    //FM multipath, percent
+  uint8_t  flags;   //RSQ_*
+} si4734_rsq_t;
+
+//Station table. fm_scan_start() seeks up through the band in the background
+//and keeps every valid station, in frequency order, up to SI4734_STATIONS
+//(the weakest give way when it is full). The table is saved to EEPROM by
+//fm_stations_save() from the main loop, a byte per call, see
+//fm_stations_saving(). Entries are two bytes: the channel,
+//(freq - FM_CHAN_BASE) / 10, and the RSSI in dBuV.
+#define SI4734_STATIONS 16
+#define FM_CHAN_BASE    8750
+
+typedef struct {
+  uint8_t chan;
+  uint8_t rssi;
+} si4734_station_t;
+
+//command engine counters, see si4734_get_stats()
+typedef struct {
+  uint16_t cmds;       //commands completed
+  uint16_t dropped;    //commands lost to a full queue
+  uint16_t twi_errors; //commands the TWI could not deliver
+  uint16_t cts_polls;  //status reads that found CTS still low
+  uint16_t cts_failed; //commands abandoned after SI4734_CTS_TRIES reads
+  uint16_t prop_hits;  //SET_PROPERTY skipped, value already set
+  uint16_t prop_miss;  //SET_PROPERTY sent
+  uint16_t prop_merged;//SET_PROPERTY folded into one still queued
+  uint16_t tune_merged;//radio_tune_request() folded into a later tune
+} si4734_stats_t;
+
 #define FALSE 0          //0x00
 #define TRUE  1          //0x01
 
-extern volatile enum radio_band current_radio_band;
-
-extern uint16_t eeprom_fm_freq;
-extern uint16_t eeprom_am_freq;
-extern uint16_t eeprom_sw_freq;
-extern uint8_t  eeprom_volume;
+extern volatile enum radio_band current_radio_band; //band the chip is in, or going to
 
 extern uint16_t current_fm_freq;
 extern uint16_t current_am_freq;
 extern uint16_t current_sw_freq;
 extern uint8_t  current_volume;
 
+extern volatile uint8_t STC_interrupt; //set when a tune or seek completes
+
 //Used in debug mode for UART1
 extern char uart1_tx_buf[40];      //holds string to send to crt
 extern char uart1_rx_buf[40];      //holds string that recieves data from uart
 
 //si4734.c function prototypes
-uint8_t get_int_status();
+void    si4734_int();
+void    si4734_tick();
+uint8_t si4734_busy();
+void    si4734_get_stats(si4734_stats_t *stats);
+void    si4734_rsq_second();
+uint8_t si4734_rsq_read(si4734_rsq_t *rsq);
+void    get_int_status();
 void    fm_tune_freq();
+void    radio_tune_request();
+void    radio_band_switch(uint8_t band);
+uint8_t radio_switching();
+void    fm_scan_start();
+void    fm_scan_stop();
+uint8_t fm_scanning();
+uint8_t fm_station_step(int8_t dir);
+uint8_t fm_stations_load();
+void    fm_stations_save();
+uint8_t fm_stations_saving();
 void    am_tune_freq();
 void    sw_tune_freq();
 void    fm_tune_status();
@@ -65,7 +188,6 @@ void    fm_pwr_up();
 void    am_pwr_up();
 void    sw_pwr_up();
 void    radio_pwr_dwn();
-void    set_property();
+void    set_property(uint16_t property, uint16_t property_value);
 void    get_rev();
-void    get_fm_rsq_status();
 
@@ -0,0 +1,24 @@
+//avr/eeprom.h for the TWI bus simulator
+//EEPROM variables live in host memory.
+
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+static inline uint8_t  eeprom_is_ready(void)                       {return(1);}
+
+static inline uint8_t  eeprom_read_byte(const uint8_t *p)          {return(*p);}
+static inline uint16_t eeprom_read_word(const uint16_t *p)         {return(*p);}
+static inline void     eeprom_write_byte(uint8_t *p, uint8_t v)    {*p = v;}
+static inline void     eeprom_write_word(uint16_t *p, uint16_t v)  {*p = v;}
+static inline void     eeprom_update_byte(uint8_t *p, uint8_t v)   {*p = v;}
+static inline void     eeprom_update_word(uint16_t *p, uint16_t v) {*p = v;}
+static inline void     eeprom_read_block(void *dst, const void *src, size_t n){memcpy(dst, src, n);}
+static inline void     eeprom_write_block(const void *src, void *dst, size_t n){memcpy(dst, src, n);}
+static inline void     eeprom_update_block(const void *src, void *dst, size_t n){memcpy(dst, src, n);}
+
+#endif //SIM_AVR_EEPROM_H
@@ -0,0 +1,13 @@
+//avr/interrupt.h for the TWI bus simulator
+//ISR(TWI_vect) becomes a plain function the simulator calls.
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#define ISR(vector) void vector(void)
+#define TWI_vect    sim_twi_isr
+
+void cli(void);
+void sei(void);
+
+#endif //SIM_AVR_INTERRUPT_H
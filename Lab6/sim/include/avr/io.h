@@ -0,0 +1,28 @@
+//avr/io.h for the TWI bus simulator
+//The registers the drivers touch are plain variables, defined in sim_twi.c.
+//The TWI model reacts to TWCR writes, see sim.h.
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+
+extern volatile uint8_t TWCR, TWSR, TWDR, TWBR, TWAR;
+extern volatile uint8_t PORTC, DDRC, PINC;
+extern volatile uint8_t PORTD, DDRD, PIND;
+extern volatile uint8_t PORTE, DDRE, PINE;
+extern volatile uint8_t EIMSK, EICRB;
+
+uint16_t sim_tcnt3(void);
+#define TCNT3 sim_tcnt3()
+
+//TWCR bits
+#define TWINT 7
+#define TWEA  6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC  3
+#define TWEN  2
+#define TWIE  0
+
+#endif //SIM_AVR_IO_H
@@ -0,0 +1,17 @@
+//avr/pgmspace.h for the TWI bus simulator
+//Flash is ordinary memory on the host.
+
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s)            (s)
+#define pgm_read_byte(p)   (*(const uint8_t *)(p))
+#define pgm_read_word(p)   (*(const uint16_t *)(p))
+#define strcpy_P(d, s)     strcpy((d), (s))
+#define strcmp_P(a, b)     strcmp((a), (b))
+
+#endif //SIM_AVR_PGMSPACE_H
@@ -0,0 +1,14 @@
+//stdlib.h for the TWI bus simulator
+//Adds the avr-libc number to string conversions, defined in sim_board.c.
+
+#ifndef SIM_STDLIB_H
+#define SIM_STDLIB_H
+
+#include_next <stdlib.h>
+
+char *itoa(int val, char *s, int radix);
+char *utoa(unsigned int val, char *s, int radix);
+char *ltoa(long val, char *s, int radix);
+char *ultoa(unsigned long val, char *s, int radix);
+
+#endif //SIM_STDLIB_H
@@ -0,0 +1,17 @@
+//util/atomic.h for the TWI bus simulator
+//The block runs with the simulator's interrupts masked and restores the
+//previous state on the way out, including by return or break.
+
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#include "sim.h"
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+
+#define ATOMIC_BLOCK(type)                                                   \
+  for(uint8_t sim_sreg __attribute__((cleanup(sim_irq_restore))) =          \
+        sim_irq_save(), sim_once = 1; sim_once; sim_once = 0)
+
+#endif //SIM_UTIL_ATOMIC_H
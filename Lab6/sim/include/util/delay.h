@@ -0,0 +1,12 @@
+//util/delay.h for the TWI bus simulator
+//Delays let simulated time pass instead of burning cycles.
+
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+#include "sim.h"
+
+static inline void _delay_us(double us){sim_run_for((uint64_t)(us * 1000.0));}
+static inline void _delay_ms(double ms){sim_run_for((uint64_t)(ms * 1000000.0));}
+
+#endif //SIM_UTIL_DELAY_H
@@ -0,0 +1,87 @@
+//sim.h
+//Host side model of the mega128 TWI unit and the devices on the alarm clock's
+//TWI bus (LM73 and Si4734). twi_master.c and si4734.c are compiled for the
+//host, unmodified, against the AVR headers in include/ and run against these
+//models so bus time and interrupt counts can be measured without hardware.
+//
+//Time is simulated. It moves forward in SIM_QUANTUM_NS steps from a host
+//interval timer (SIGALRM), which also plays the part of the AVR interrupt
+//system: cli()/sei() and ATOMIC_BLOCK mask the signal, and interrupt
+//handlers are run from it. _delay_us()/_delay_ms() fast forward the clock.
+//Only the interrupt driven TWI driver is modeled, TWINT is not readable.
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#define SIM_F_CPU        16000000ULL //mega128 clock
+#define SIM_QUANTUM_NS   10000       //simulated time per host timer tick
+#define SIM_HOST_TICK_US 50          //host timer interval
+#define SIM_TIMER2_NS    128000      //TIMER2_OVF period on the alarm clock
+#define SIM_TWI_SW_NS    3000        //ISR entry, switch and exit before a TWCR write acts
+
+//time
+uint64_t sim_now(void);               //simulated time in ns since start
+void     sim_run_for(uint64_t ns);    //let ns of simulated time pass
+void     sim_start(void);             //start the host timer
+void     sim_stop(void);
+
+//interrupt mask, used by cli(), sei() and ATOMIC_BLOCK
+uint8_t  sim_irq_save(void);          //disable, return previous state
+void     sim_irq_restore(uint8_t *state);
+
+//timed events, run in simulated time order
+typedef void (*sim_fn_t)(void);
+void     sim_at(uint64_t when, sim_fn_t fn);  //one event per fn, rescheduling moves it
+void     sim_cancel(sim_fn_t fn);
+
+//interrupt sources, handlers are run when interrupts are enabled
+void     sim_set_timer2_isr(sim_fn_t isr);    //called every SIM_TIMER2_NS
+void     sim_set_int7_isr(sim_fn_t isr);      //called on an Si4734 INT pulse
+void     sim_raise_int7(void);
+void     sim_twi_flag(void);                  //TWINT set by the TWI model
+
+//counters, cleared by sim_stats_reset()
+typedef struct {
+  uint64_t bus_ns;     //time the bus was driven
+  uint32_t starts;     //START and repeated START conditions
+  uint32_t stops;      //STOP conditions
+  uint32_t bytes;      //bytes clocked, SLA+RW included
+  uint32_t nacks;      //bytes not acknowledged
+  uint32_t twi_isr;    //TWI_vect entries
+  uint32_t timer2_isr; //TIMER2_OVF entries
+  uint32_t int7_isr;   //INT7_vect entries
+  uint32_t hangs;      //transfers stalled by a device
+  uint32_t resets;     //TWI disabled while the bus was in use
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;
+void sim_stats_reset(void);
+
+//a device on the bus. Called by the TWI model as the master drives the bus.
+typedef struct sim_dev {
+  const char *name;
+  uint8_t    addr;                   //SLA with R/W cleared
+  uint8_t    hung;                   //set to stop answering, models a stuck slave
+  uint8_t    (*start)(uint8_t read); //addressed, return 1 to ACK
+  uint8_t    (*write)(uint8_t byte); //byte from master, return 1 to ACK
+  uint8_t    (*read)(void);          //byte to master
+  void       (*stop)(void);          //STOP or repeated START ends the transfer
+  uint32_t   bytes;                  //bytes to or from this device
+} sim_dev_t;
+
+void sim_twi_attach(sim_dev_t *dev);
+void sim_twi_poll(void);             //pick up a TWCR write
+uint8_t sim_twi_bus_free(void);      //no transfer owns the bus
+void sim_twi_reset(void);
+
+//device models
+extern sim_dev_t sim_lm73;
+extern sim_dev_t sim_si4734;
+void     sim_lm73_set_temp(int16_t centi_c);
+void     sim_si4734_reset(void);
+uint32_t sim_si4734_dropped(void);   //commands sent while the chip was busy
+uint16_t sim_si4734_mute(void);      //RX_HARD_MUTE as the chip has it
+
+#endif //SIM_H
@@ -0,0 +1,57 @@
+//sim_board.c
+//What the rest of the alarm clock firmware provides to twi_master.c and
+//si4734.c: the radio globals from lab6.c, UART1 and log output, and the
+//avr-libc number conversions the host C library lacks.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../si4734.h"
+
+volatile enum radio_band current_radio_band = FM;
+
+uint16_t current_fm_freq = 10630;
+uint16_t current_am_freq = 1190;
+uint16_t current_sw_freq = 9500;
+uint8_t  current_volume  = 0x20;
+
+void uart1_puts(char *str){fputs(str, stdout);}
+
+//LOG() records, the IDs mean nothing without the AVR ELF so only the
+//arguments are shown
+void log_write(uint16_t id, const uint16_t *args, uint8_t n){
+  uint8_t i;
+
+  printf("log %u:", id);
+  for(i = 0; i < n; i++){printf(" %u", args[i]);}
+  printf("\n");
+}
+
+//******************************************************************************
+//                              itoa and friends
+//
+char *ultoa(unsigned long val, char *s, int radix){
+  char    tmp[33];
+  uint8_t i = 0, j = 0;
+
+  do{
+    tmp[i++] = "0123456789abcdefghijklmnopqrstuvwxyz"[val % radix];
+    val /= radix;
+  }while(val);
+  while(i){s[j++] = tmp[--i];}
+  s[j] = '\0';
+  return(s);
+}
+
+char *ltoa(long val, char *s, int radix){
+  if(val < 0 && radix == 10){s[0] = '-'; ultoa(-(unsigned long)val, s + 1, radix); return(s);}
+  return(ultoa((unsigned long)val, s, radix));
+}
+
+char *utoa(unsigned int val, char *s, int radix){return(ultoa(val, s, radix));}
+
+char *itoa(int val, char *s, int radix){
+  if(radix == 10){return(ltoa(val, s, radix));}
+  return(ultoa((unsigned int)val, s, radix));
+}
@@ -0,0 +1,229 @@
+//sim_core.c
+//Simulated time, timed events and the interrupt system for the TWI bus
+//simulator. See sim.h.
+
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include "sim.h"
+
+#define SIM_EVENTS 16  //timed events pending at once
+
+typedef struct {
+  sim_fn_t fn;
+  uint64_t when;
+} sim_event_t;
+
+sim_stats_t sim_stats;
+
+static volatile uint64_t sim_time;           //simulated ns
+static sim_event_t       sim_events[SIM_EVENTS];
+
+static sim_fn_t          sim_timer2_isr;
+static sim_fn_t          sim_int7_isr;
+static volatile uint8_t  sim_timer2_pending;
+static volatile uint8_t  sim_int7_pending;
+static volatile uint8_t  sim_twi_pending;
+
+extern volatile uint8_t TWCR;  //TWIE gates the TWI interrupt
+void sim_twi_isr(void);   //ISR(TWI_vect) in twi_master.c
+
+//******************************************************************************
+//                              sim_now
+//
+uint64_t sim_now(void){return(sim_time);}
+
+//******************************************************************************
+//                              sim_tcnt3
+//
+//TCNT3 as set up on the alarm clock: clk/1, fast PWM with TOP at 0x2000.
+//
+uint16_t sim_tcnt3(void){
+  return((uint16_t)((sim_time * (SIM_F_CPU / 1000000ULL) / 1000ULL) % 0x2001));
+}
+
+//******************************************************************************
+//                              sim_stats_reset
+//
+void sim_stats_reset(void){memset(&sim_stats, 0, sizeof(sim_stats));}
+
+//******************************************************************************
+//                              sim_irq_save
+//
+//Interrupts are the host timer signal. Disabled means SIGALRM is blocked,
+//which is also the case inside the signal handler, as it is inside an ISR.
+//
+uint8_t sim_irq_save(void){
+  sigset_t block, old;
+
+  sigemptyset(&block);
+  sigaddset(&block, SIGALRM);
+  sigprocmask(SIG_BLOCK, &block, &old);
+  return(!sigismember(&old, SIGALRM));
+}
+
+//******************************************************************************
+//                              sim_irq_restore
+//
+void sim_irq_restore(uint8_t *state){
+  sigset_t block;
+
+  if(!*state){return;}
+  sigemptyset(&block);
+  sigaddset(&block, SIGALRM);
+  sigprocmask(SIG_UNBLOCK, &block, NULL);
+}
+
+void cli(void){sim_irq_save();}
+void sei(void){uint8_t on = 1; sim_irq_restore(&on);}
+
+//******************************************************************************
+//                              sim_at
+//
+void sim_at(uint64_t when, sim_fn_t fn){
+  uint8_t i, slot = SIM_EVENTS;
+
+  for(i = 0; i < SIM_EVENTS; i++){
+    if(sim_events[i].fn == fn){slot = i; break;}
+    if(sim_events[i].fn == NULL && slot == SIM_EVENTS){slot = i;}
+  }
+  if(slot == SIM_EVENTS){return;} //table full, should not happen
+  sim_events[slot].fn   = fn;
+  sim_events[slot].when = when;
+}
+
+//******************************************************************************
+//                              sim_cancel
+//
+void sim_cancel(sim_fn_t fn){
+  uint8_t i;
+
+  for(i = 0; i < SIM_EVENTS; i++){
+    if(sim_events[i].fn == fn){sim_events[i].fn = NULL;}
+  }
+}
+
+//******************************************************************************
+//                              interrupt sources
+//
+static void sim_timer2_ovf(void){
+  sim_timer2_pending = 1;
+  sim_at(sim_time + SIM_TIMER2_NS, sim_timer2_ovf);
+}
+
+void sim_set_timer2_isr(sim_fn_t isr){sim_timer2_isr = isr;}
+void sim_set_int7_isr(sim_fn_t isr)  {sim_int7_isr = isr;}
+void sim_raise_int7(void)            {sim_int7_pending = 1;}
+void sim_twi_flag(void)              {sim_twi_pending = 1;}
+
+//******************************************************************************
+//                              sim_advance
+//
+//Moves the hardware forward by ns, running timed events in order. With
+//irq set, interrupt handlers run as soon as they become pending, at the
+//simulated time of the event, otherwise they wait.
+//
+static void sim_dispatch(void);
+
+static void sim_advance(uint64_t ns, uint8_t irq){
+  uint64_t end = sim_time + ns;
+  uint8_t  i, next;
+  sim_fn_t fn;
+
+  sim_twi_poll();
+  if(irq){sim_dispatch();}
+  for(;;){
+    next = SIM_EVENTS;
+    for(i = 0; i < SIM_EVENTS; i++){
+      if(sim_events[i].fn == NULL || sim_events[i].when > end){continue;}
+      if(next == SIM_EVENTS || sim_events[i].when < sim_events[next].when){next = i;}
+    }
+    if(next == SIM_EVENTS){break;}
+    if(sim_events[next].when > sim_time){sim_time = sim_events[next].when;}
+    fn = sim_events[next].fn;
+    sim_events[next].fn = NULL;
+    fn();
+    if(irq){sim_dispatch();}
+  }
+  if(sim_time < end){sim_time = end;} //a nested delay may have gone past
+}
+
+//******************************************************************************
+//                              sim_dispatch
+//
+//Runs pending interrupt handlers, in AVR vector priority order: INT7,
+//TIMER2_OVF, TWI. Called with interrupts disabled, as an ISR would be.
+//
+static void sim_dispatch(void){
+  for(;;){
+    if(sim_int7_pending){
+      sim_int7_pending = 0;
+      sim_stats.int7_isr++;
+      if(sim_int7_isr){sim_int7_isr();}
+    }
+    else if(sim_timer2_pending){
+      sim_timer2_pending = 0;
+      sim_stats.timer2_isr++;
+      if(sim_timer2_isr){sim_timer2_isr();}
+    }
+    else if(sim_twi_pending && (TWCR & 0x01)){ //TWIE
+      sim_twi_pending = 0;
+      sim_stats.twi_isr++;
+      sim_twi_isr();
+    }
+    else{break;}
+    sim_twi_poll();
+  }
+}
+
+//******************************************************************************
+//                              sim_run_for
+//
+//Lets simulated time pass, as _delay_us() does. From main, with interrupts
+//on, handlers run as things happen. From an ISR, or with interrupts off,
+//time passes but handlers wait.
+//
+void sim_run_for(uint64_t ns){
+  uint8_t state = sim_irq_save();
+
+  sim_advance(ns, state);
+  sim_irq_restore(&state);
+}
+
+//******************************************************************************
+//                              sim_alarm
+//
+//Host timer tick. Simulated time moves on while main spins.
+//
+static void sim_alarm(int sig){
+  (void)sig;
+  sim_advance(SIM_QUANTUM_NS, 1);
+}
+
+//******************************************************************************
+//                              sim_start, sim_stop
+//
+void sim_start(void){
+  struct sigaction  act;
+  struct itimerval  tick;
+
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = sim_alarm;
+  act.sa_flags   = SA_RESTART;
+  sigemptyset(&act.sa_mask);
+  sigaction(SIGALRM, &act, NULL);
+
+  if(sim_timer2_isr){sim_at(sim_time + SIM_TIMER2_NS, sim_timer2_ovf);}
+
+  tick.it_interval.tv_sec  = 0;
+  tick.it_interval.tv_usec = SIM_HOST_TICK_US;
+  tick.it_value            = tick.it_interval;
+  setitimer(ITIMER_REAL, &tick, NULL);
+}
+
+void sim_stop(void){
+  struct itimerval off;
+
+  memset(&off, 0, sizeof(off));
+  setitimer(ITIMER_REAL, &off, NULL);
+}
@@ -0,0 +1,81 @@
+//sim_lm73.c
+//Model of the LM73 temperature sensor at 0x90. Register pointer set by the
+//first byte of a write, 16 bit registers sent MSB first, temperature
+//truncated to the resolution selected in the control/status register.
+
+#include "sim.h"
+
+#define LM73_REG_TEMP   0x00
+#define LM73_REG_CONFIG 0x01
+#define LM73_REG_THIGH  0x02
+#define LM73_REG_TLOW   0x03
+#define LM73_REG_CTRL   0x04
+#define LM73_REG_ID     0x07
+
+static uint8_t  lm73_ptr;
+static uint8_t  lm73_first;    //next write byte is the pointer
+static uint8_t  lm73_idx;      //byte within the register
+static int16_t  lm73_temp  = 23 * 128;  //degrees C x 128
+static uint8_t  lm73_config = 0x40;
+static uint16_t lm73_thigh = 127 * 128;
+static uint16_t lm73_tlow  = 126 * 128;
+static uint8_t  lm73_ctrl  = 0x08;      //11 bit, DAV
+
+//******************************************************************************
+//                              sim_lm73_set_temp
+//
+void sim_lm73_set_temp(int16_t centi_c){lm73_temp = (int32_t)centi_c * 128 / 100;}
+
+static uint16_t lm73_reg(void){
+  static const uint16_t res_mask[4] = {0xFFE0, 0xFFF0, 0xFFF8, 0xFFFC};
+
+  switch(lm73_ptr){
+    case LM73_REG_TEMP  : return((uint16_t)lm73_temp & res_mask[(lm73_ctrl >> 5) & 0x03]);
+    case LM73_REG_THIGH : return(lm73_thigh);
+    case LM73_REG_TLOW  : return(lm73_tlow);
+    case LM73_REG_ID    : return(0x0190);
+    default             : return(0);
+  }
+}
+
+static uint8_t lm73_start(uint8_t read){
+  lm73_first = !read;
+  lm73_idx   = 0;
+  return(1);
+}
+
+static uint8_t lm73_write(uint8_t byte){
+  if(lm73_first){
+    if(byte > LM73_REG_ID){return(0);} //no such register
+    lm73_ptr   = byte;
+    lm73_first = 0;
+    return(1);
+  }
+  switch(lm73_ptr){
+    case LM73_REG_CONFIG : lm73_config = byte; break;
+    case LM73_REG_CTRL   : lm73_ctrl = (byte & 0xE0) | (lm73_ctrl & 0x1F); break;
+    case LM73_REG_THIGH  :
+      lm73_thigh = lm73_idx ? ((lm73_thigh & 0xFF00) | byte) : ((uint16_t)byte << 8);
+      break;
+    case LM73_REG_TLOW   :
+      lm73_tlow = lm73_idx ? ((lm73_tlow & 0xFF00) | byte) : ((uint16_t)byte << 8);
+      break;
+    default              : return(0); //read only
+  }
+  lm73_idx++;
+  return(1);
+}
+
+static uint8_t lm73_read(void){
+  uint8_t byte;
+
+  if(lm73_ptr == LM73_REG_CONFIG){return(lm73_config);}
+  if(lm73_ptr == LM73_REG_CTRL)  {return(lm73_ctrl);}
+  byte = (lm73_idx & 1) ? (uint8_t)lm73_reg() : (uint8_t)(lm73_reg() >> 8);
+  lm73_idx++;
+  return(byte);
+}
+
+static void lm73_stop(void){}
+
+sim_dev_t sim_lm73 = {"LM73", 0x90, 0, lm73_start, lm73_write, lm73_read, lm73_stop, 0};
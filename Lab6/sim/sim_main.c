@@ -0,0 +1,514 @@
+//sim_main.c
+//Runs the TWI driver and the Si4734 driver against the bus models and
+//reports, per scenario, simulated time, time the bus was held, bus
+//conditions and bytes, and interrupt handler entries. Each scenario also
+//checks its outcome; a failed check is printed and makes the exit status
+//non-zero, so make run works as a regression test.
+//
+//  make run
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/twi.h>
+#include "sim.h"
+#include "../twi_master.h"
+#include "../si4734.h"
+
+#define LM73_ADDRESS  0x90
+#define ABSENT_ADDRESS 0x70         //nothing on the bus answers to it
+#define LM73_READS    100
+#define RSQ_POLLS     20
+#define STC_WAIT_NS   200000000ULL  //give up on a tune after 200ms
+#define MUTE_PRESSES  20
+#define MUTE_GAP_NS   2000000ULL    //between button presses
+#define KNOB_DETENTS  30
+#define KNOB_GAP_NS   4000000ULL    //between detents, a quick spin
+#define LM73_POLLS    20
+#define POLL_GAP_NS   1000000ULL    //the 1s temperature poll, sped up
+#define POST_MAX_NS   (3 * SIM_QUANTUM_NS) //a post may straddle a host tick, no more
+#define TICK_MAX_NS   SIM_TWI_SW_NS //twi_tick() in TIMER2, no waiting in there
+
+extern uint8_t si4734_tune_status_buf[8];
+extern uint8_t si4734_revision_buf[16];
+
+#define LM73_TEMP      0x0BC0        //23.50C as the LM73 reads it, 11 bit
+#define MAIN_PASS_NS   1000000ULL    //longest main loop pass allowed while switching
+
+static uint8_t  lm73_wr_buf[1];
+static uint8_t  lm73_rd_buf[2];
+static uint64_t scen_start;
+static uint16_t sim_failed;        //checks that did not hold
+
+//******************************************************************************
+//                              check
+//
+//Reports an expectation that did not hold. main() exits non-zero if any failed.
+//
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(int ok, const char *what, int line){
+  if(ok){return;}
+  printf("  FAIL sim_main.c:%d: %s\n", line, what);
+  sim_failed++;
+}
+
+static uint16_t lm73_temp(void){return((lm73_rd_buf[0] << 8) | lm73_rd_buf[1]);}
+static uint16_t tuned_freq(void){
+  return((si4734_tune_status_buf[2] << 8) | si4734_tune_status_buf[3]);
+}
+
+static uint64_t tick_worst;        //longest twi_tick(), simulated time
+
+//interrupt handlers as lab6.c has them. Delays inside an ISR move the
+//simulated clock, so a twi_tick() that busy-waits shows up in tick_worst.
+static void timer2_isr(void){
+  uint64_t t = sim_now();
+
+  twi_tick();
+  t = sim_now() - t;
+  if(t > tick_worst){tick_worst = t;}
+  si4734_tick();
+}
+static void int7_isr(void)  {si4734_int();}
+
+static void twi_wait(void)  {while(twi_busy()){};}
+static void radio_wait(void){while(si4734_busy()){};}
+
+//******************************************************************************
+//                              scenario_begin, scenario_end
+//
+static void scenario_begin(void){
+  radio_wait();
+  twi_wait();
+  sim_stats_reset();
+  scen_start = sim_now();
+}
+
+static void scenario_end(const char *name, uint16_t reps){
+  uint64_t t = sim_now() - scen_start;
+
+  printf("%-24s %4u %9.2f %9.1f %5.1f %6u %6u %6u %5u %6u %6u %5u %5u %5u\n",
+         name, reps, t / 1e6, sim_stats.bus_ns / 1e3,
+         t ? 100.0 * sim_stats.bus_ns / t : 0.0,
+         sim_stats.starts, sim_stats.stops, sim_stats.bytes, sim_stats.nacks,
+         sim_stats.twi_isr, sim_stats.timer2_isr, sim_stats.int7_isr,
+         sim_stats.hangs, sim_stats.resets);
+}
+
+//******************************************************************************
+//                              scenarios
+//
+static void lm73_separate(void){
+  uint16_t i;
+
+  scenario_begin();
+  for(i = 0; i < LM73_READS; i++){
+    twi_start_wr(LM73_ADDRESS, lm73_wr_buf, 1);  //pointer, then a new transfer
+    twi_start_rd(LM73_ADDRESS, lm73_rd_buf, 2);
+    twi_wait();
+  }
+  scenario_end("lm73 wr + rd", LM73_READS);
+  CHECK(sim_stats.starts == 2 * LM73_READS && sim_stats.stops == 2 * LM73_READS);
+  CHECK(sim_stats.bytes == 5 * LM73_READS && sim_stats.nacks == 0);
+  CHECK(lm73_temp() == LM73_TEMP);
+}
+
+static void lm73_combined(void){
+  uint16_t i;
+
+  scenario_begin();
+  for(i = 0; i < LM73_READS; i++){
+    twi_start_wr_rd(LM73_ADDRESS, lm73_wr_buf, 1, lm73_rd_buf, 2);
+    twi_wait();
+  }
+  scenario_end("lm73 wr_rd", LM73_READS);
+  CHECK(sim_stats.starts == 2 * LM73_READS && sim_stats.stops == LM73_READS); //Sr, one STOP
+  CHECK(sim_stats.bytes == 5 * LM73_READS && sim_stats.nacks == 0);
+  CHECK(lm73_temp() == LM73_TEMP);
+}
+
+//the LM73 stops answering mid transfer: the transfer has to time out, the
+//bus be clocked free and released, and the retry go through, while TIMER2
+//keeps running
+static void lm73_stall(void){
+  volatile uint8_t status;
+  twi_stats_t      before, after;
+
+  twi_get_stats(&before);
+  scenario_begin();
+  tick_worst = 0;
+  lm73_rd_buf[0] = lm73_rd_buf[1] = 0;
+  sim_lm73.hung = 1;
+  twi_post(LM73_ADDRESS, lm73_wr_buf, 1, lm73_rd_buf, 2, &status);
+  while(status & TWI_XFER_PENDING){};
+  scenario_end("lm73 stall, recover", 1);
+  twi_get_stats(&after);
+  printf("  status 0x%02x  timeouts %u recoveries %u failed %u  temp 0x%04x  longest tick %.1f us\n",
+         status, after.timeouts - before.timeouts, after.recoveries - before.recoveries,
+         after.failed - before.failed, lm73_temp(), tick_worst / 1e3);
+  CHECK(status == TWI_XFER_DONE);
+  CHECK(after.timeouts - before.timeouts == 1 && after.recoveries - before.recoveries == 1);
+  CHECK(after.failed == before.failed);
+  CHECK(sim_stats.hangs == 1 && sim_stats.resets == 1);
+  CHECK(sim_stats.timer2_isr > TWI_TIMEOUT_TICKS + TWI_RECOVER_EDGES);
+  CHECK(tick_worst < TICK_MAX_NS);
+  CHECK(lm73_temp() == LM73_TEMP);
+  CHECK(sim_twi_bus_free());
+  CHECK(!(TWI_DDR & ((1<<TWI_SCL_BIT) | (1<<TWI_SDA_BIT)))); //recovery let go of the pins
+}
+
+//nobody at the address: each try is NACKed, and after TWI_MAX_RETRIES the
+//transfer is dropped with an error instead of retried forever
+static void twi_absent(void){
+  volatile uint8_t status;
+  twi_stats_t      before, after;
+
+  twi_get_stats(&before);
+  scenario_begin();
+  twi_post(ABSENT_ADDRESS, lm73_wr_buf, 1, lm73_rd_buf, 2, &status);
+  while(status & TWI_XFER_PENDING){};
+  scenario_end("absent device, give up", 1);
+  twi_get_stats(&after);
+  printf("  status 0x%02x  nacks %u failed %u  twi_error 0x%02x\n", status,
+         after.nacks - before.nacks, after.failed - before.failed, twi_error());
+  CHECK(status == (TWI_XFER_DONE | TWI_XFER_ERROR));
+  CHECK(after.nacks - before.nacks == TWI_MAX_RETRIES + 1);
+  CHECK(after.failed - before.failed == 1);
+  CHECK(sim_twi_bus_free());
+}
+
+static void radio_power_up(void){
+  scenario_begin();
+  fm_pwr_up();
+  radio_wait();
+  scenario_end("fm_pwr_up", 1);
+  CHECK(sim_stats.nacks == 0 && sim_stats.int7_isr > 0);
+}
+
+static void radio_tune(void){
+  scenario_begin();
+  current_fm_freq = 9450;
+  fm_tune_freq();
+  while(!STC_interrupt && (sim_now() - scen_start) < STC_WAIT_NS){};
+  fm_tune_status();
+  radio_wait();
+  scenario_end("fm_tune_freq + status", 1);
+  printf("  STC %s  freq %u  rssi %u\n", STC_interrupt ? "seen" : "never came",
+         tuned_freq(), si4734_tune_status_buf[4]);
+  CHECK(STC_interrupt);
+  CHECK(tuned_freq() == 9450);
+}
+
+//the temperature poll posted while the radio is tuning: every post has to
+//return at once, with the bus busy or not, and still be carried out
+static void lm73_poll_tune(void){
+  volatile uint8_t status;
+  uint64_t t, worst = 0;
+  uint16_t i, good = 0;
+
+  scenario_begin();
+  t = sim_now();
+  fm_tune_freq();                    //current_fm_freq is still 9450
+  worst = sim_now() - t;
+  for(i = 0; i < LM73_POLLS; i++){
+    lm73_rd_buf[0] = lm73_rd_buf[1] = 0;
+    t = sim_now();
+    twi_post(LM73_ADDRESS, lm73_wr_buf, 1, lm73_rd_buf, 2, &status);
+    t = sim_now() - t;
+    if(t > worst){worst = t;}
+    sim_run_for(POLL_GAP_NS);
+    if(status == TWI_XFER_DONE && lm73_temp() == LM73_TEMP){good++;}
+  }
+  while(!STC_interrupt && (sim_now() - scen_start) < STC_WAIT_NS){};
+  fm_tune_status();
+  radio_wait();
+  scenario_end("lm73 poll while tuning", LM73_POLLS);
+  printf("  longest post %.1f us  reads good %u  freq %u\n", worst / 1e3, good, tuned_freq());
+  CHECK(worst <= POST_MAX_NS);
+  CHECK(good == LM73_POLLS);
+  CHECK(STC_interrupt && tuned_freq() == current_fm_freq);
+}
+
+static void radio_rsq(void){
+  uint16_t i;
+
+  scenario_begin();
+  for(i = 0; i < RSQ_POLLS; i++){fm_rsq_status(); radio_wait();}
+  scenario_end("fm_rsq_status", RSQ_POLLS);
+  CHECK(sim_stats.nacks == 0 && sim_stats.int7_isr == RSQ_POLLS);
+}
+
+static void radio_properties(void){
+  scenario_begin();
+  set_property(RX_HARD_MUTE, 0x0000);
+  set_property(GPO_IEN, GPO_IEN_STCIEN | GPO_IEN_CTSIEN);
+  set_property(AM_CHANNEL_FILTER, AM_CHFILT_4KHZ);
+  radio_wait();
+  scenario_end("set_property x3", 3);
+  CHECK(sim_stats.nacks == 0);
+}
+
+static void radio_mute(void){
+  si4734_stats_t before, after;
+  uint16_t       i;
+
+  si4734_get_stats(&before);
+  scenario_begin();
+  for(i = 0; i < MUTE_PRESSES; i++){ //each value pressed twice, a press every 2ms
+    set_property(RX_HARD_MUTE, ((i >> 1) & 1) ? 0x0003 : 0x0000);
+    sim_run_for(MUTE_GAP_NS);
+  }
+  radio_wait();
+  scenario_end("mute presses", MUTE_PRESSES);
+  si4734_get_stats(&after);
+  printf("  prop hit %u miss %u merged %u\n", after.prop_hits - before.prop_hits,
+         after.prop_miss - before.prop_miss, after.prop_merged - before.prop_merged);
+  CHECK((uint16_t)(after.prop_hits - before.prop_hits) +
+        (uint16_t)(after.prop_miss - before.prop_miss) +
+        (uint16_t)(after.prop_merged - before.prop_merged) == MUTE_PRESSES);
+  CHECK(after.prop_merged != before.prop_merged);  //repeats folded, not queued
+}
+
+//two presses while the engine is reading the status after an STC edge: the
+//SET_PROPERTY queued behind that read has not gone out, so the second press
+//has to fold into it
+static void radio_mute_stc(void){
+  si4734_stats_t before, after;
+
+  si4734_get_stats(&before);
+  scenario_begin();
+  cli();                             //hold the engine in SI_STATUS
+  si4734_int();
+  set_property(RX_HARD_MUTE, 0x0000);
+  set_property(RX_HARD_MUTE, 0x0003);
+  sei();
+  radio_wait();
+  scenario_end("mute presses, STC read", 2);
+  si4734_get_stats(&after);
+  printf("  prop miss %u merged %u\n", after.prop_miss - before.prop_miss,
+         after.prop_merged - before.prop_merged);
+  CHECK(after.prop_miss - before.prop_miss == 1 && after.prop_merged - before.prop_merged == 1);
+}
+
+//a SET_PROPERTY queued ahead of a power cycle is undone by it, so the same
+//setting made behind the power cycle has to go out on its own and the chip
+//has to end up with it
+static void radio_prop_power(void){
+  si4734_stats_t before, after;
+
+  si4734_get_stats(&before);
+  scenario_begin();
+  cli();                             //queue it all before anything goes out
+  get_int_status();                  //the tail, on its way
+  set_property(RX_HARD_MUTE, 0x0001);
+  radio_pwr_dwn();
+  fm_pwr_up();
+  set_property(RX_HARD_MUTE, 0x0001);
+  sei();
+  radio_wait();
+  scenario_end("set, power cycle, set", 2);
+  si4734_get_stats(&after);
+  printf("  prop miss %u merged %u  chip mute 0x%04x\n", after.prop_miss - before.prop_miss,
+         after.prop_merged - before.prop_merged, sim_si4734_mute());
+  CHECK(after.prop_merged == before.prop_merged);
+  CHECK(sim_si4734_mute() == 0x0001);
+  set_property(RX_HARD_MUTE, 0x0001);  //the cache holds once it is set
+  si4734_get_stats(&before);
+  CHECK(before.prop_hits == after.prop_hits + 1);
+  set_property(RX_HARD_MUTE, 0x0000);
+  radio_wait();
+}
+
+static void tune_settled(void){
+  do{
+    while(!(STC_interrupt && !si4734_busy())){};
+    sim_run_for(2 * SIM_TIMER2_NS);  //a tick to pick up a pending request
+  }while(!(STC_interrupt && !si4734_busy()));
+}
+
+static void radio_knob(void){
+  si4734_stats_t before, after;
+  uint16_t       i, sent;
+
+  si4734_get_stats(&before);
+  scenario_begin();
+  for(i = 0; i < KNOB_DETENTS; i++){ //as encoder2_instruction() does
+    current_fm_freq += 20;
+    radio_tune_request();
+    sim_run_for(KNOB_GAP_NS);
+  }
+  tune_settled();
+  fm_tune_status();
+  radio_wait();
+  scenario_end("tuning knob spin", KNOB_DETENTS);
+  si4734_get_stats(&after);
+  sent = KNOB_DETENTS - (after.tune_merged - before.tune_merged);
+  printf("  tunes sent %u merged %u  wanted %u got %u\n",
+         sent, after.tune_merged - before.tune_merged, current_fm_freq, tuned_freq());
+  CHECK(sent <= KNOB_DETENTS / 4);   //one tune per STC, not one per detent
+  CHECK(tuned_freq() == current_fm_freq);
+}
+
+static void radio_scan(void){
+  static const uint16_t found[] = {10630, 10790, 9110, 9450}; //up from 10050, wrapping
+  uint16_t back = current_fm_freq;
+  uint8_t  i, cnt;
+
+  scenario_begin();
+  fm_scan_start();
+  while(fm_scanning()){};
+  tune_settled();                    //back on the station we were on
+  fm_tune_status();
+  radio_wait();
+  scenario_end("fm band scan", 1);
+  CHECK(current_fm_freq == back && tuned_freq() == back);
+  do{fm_stations_save();}while(fm_stations_saving()); //a byte per main loop pass
+  cnt = fm_stations_load();          //as read back at boot
+  printf("  %u stations, back on %u:", cnt, back);
+  for(i = 0; i < cnt; i++){          //as encoder2_instruction() does
+    fm_station_step(1);
+    printf(" %u", current_fm_freq);
+    CHECK(i < sizeof(found) / sizeof(found[0]) && current_fm_freq == found[i]);
+  }
+  printf("\n");
+  CHECK(cnt == sizeof(found) / sizeof(found[0]));
+  tune_settled();
+}
+
+static void radio_band(void){
+  uint64_t t, last, worst = 0;
+
+  //the old way: each step waited out in line, nothing else runs meanwhile
+  scenario_begin();
+  t = sim_now();
+  current_radio_band = AM;
+  radio_pwr_dwn();  radio_wait();
+  am_pwr_up();      radio_wait();
+  am_tune_freq();   while(!STC_interrupt){};
+  t = sim_now() - t;
+  scenario_end("band FM to AM, blocking", 1);
+  printf("  main loop stalled %.2f ms\n", t / 1e6);
+  CHECK(STC_interrupt);
+
+  //radio_band_switch(), main loop keeps going
+  scenario_begin();
+  radio_band_switch(SW);
+  last = sim_now();
+  while(radio_switching() || si4734_busy() || !STC_interrupt){
+    t = sim_now();
+    if(t - last > worst){worst = t - last;}
+    last = t;
+  }
+  scenario_end("band AM to SW, async", 1);
+  printf("  longest main loop pass %.1f us\n", worst / 1e3);
+  CHECK(worst < MAIN_PASS_NS);
+
+  scenario_begin();
+  radio_band_switch(FM);
+  while(radio_switching() || si4734_busy() || !STC_interrupt){};
+  fm_tune_status();
+  radio_wait();
+  scenario_end("band SW to FM, async", 1);
+  printf("  back on %u\n", tuned_freq());
+  CHECK(current_radio_band == FM && tuned_freq() == current_fm_freq);
+}
+
+static void radio_rsq_sampler(void){
+  si4734_rsq_t rsq;
+  uint8_t      i, seq = 0, n = 0;
+
+  scenario_begin();
+  for(i = 0; i < 2 * SI4734_RSQ_SEC; i++){ //as the real time clock ISR does
+    si4734_rsq_second();
+    sim_run_for(1000000ULL);
+  }
+  radio_wait();
+  scenario_end("rsq sampler, 2 samples", 2);
+  while(si4734_rsq_read(&rsq)){
+    printf("  seq %u band %u freq %u rssi %u snr %u mult %u flags 0x%02x\n",
+           rsq.seq, rsq.band, rsq.freq, rsq.rssi, rsq.snr, rsq.mult, rsq.flags);
+    CHECK(n == 0 || rsq.seq == (uint8_t)(seq + 1));
+    CHECK(rsq.band == FM && rsq.freq == current_fm_freq);
+    seq = rsq.seq;
+    n++;
+  }
+  CHECK(n == 2);
+}
+
+static void radio_int_status(void){
+  scenario_begin();
+  get_int_status();
+  radio_wait();
+  scenario_end("get_int_status", 1);
+  CHECK(sim_stats.nacks == 0);
+}
+
+//GET_REV is queued like any other command, the caller does not wait on it
+static void radio_rev(void){
+  uint64_t t;
+
+  scenario_begin();
+  t = sim_now();
+  get_rev();
+  t = sim_now() - t;
+  radio_wait();
+  sim_run_for(2 * SIM_TIMER2_NS);    //a tick to log it
+  scenario_end("get_rev", 1);
+  printf("  returned in %.1f us  part %u firmware %c%c rev %c\n", t / 1e3,
+         si4734_revision_buf[1], si4734_revision_buf[2], si4734_revision_buf[3],
+         si4734_revision_buf[8]);
+  CHECK(t <= POST_MAX_NS);
+  CHECK(si4734_revision_buf[1] == 34 && si4734_revision_buf[8] == 'D');
+}
+
+int main(void){
+  si4734_stats_t stats;
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  sim_twi_attach(&sim_lm73);
+  sim_twi_attach(&sim_si4734);
+  sim_si4734_reset();
+  sim_set_timer2_isr(timer2_isr);
+  sim_set_int7_isr(int7_isr);
+
+  init_twi();
+  lm73_wr_buf[0] = 0x00;  //temperature register
+  sim_lm73_set_temp(2350);
+  sim_start();
+  sei();
+
+  printf("%-24s %4s %9s %9s %5s %6s %6s %6s %5s %6s %6s %5s %5s %5s\n",
+         "scenario", "reps", "sim ms", "bus us", "bus%", "START", "STOP",
+         "bytes", "nack", "twi", "tmr2", "int7", "hang", "reset");
+  lm73_separate();
+  lm73_combined();
+  lm73_stall();
+  twi_absent();
+  radio_power_up();
+  radio_tune();
+  lm73_poll_tune();
+  radio_rsq();
+  radio_properties();
+  radio_mute();
+  radio_mute_stc();
+  radio_prop_power();
+  radio_knob();
+  radio_scan();
+  radio_band();
+  radio_rsq_sampler();
+  radio_int_status();
+  radio_rev();
+  si4734_get_stats(&stats);
+  printf("Si4734 commands dropped while busy: %u\n", sim_si4734_dropped());
+  printf("engine: cmds %u dropped %u twi_errors %u cts_polls %u cts_failed %u\n",
+         stats.cmds, stats.dropped, stats.twi_errors, stats.cts_polls, stats.cts_failed);
+  CHECK(sim_si4734_dropped() == 0);
+  CHECK(stats.dropped == 0 && stats.twi_errors == 0 && stats.cts_failed == 0);
+
+  sim_stop();
+  if(sim_failed){printf("%u checks FAILED\n", sim_failed); return(1);}
+  printf("all checks passed\n");
+  return(0);
+}
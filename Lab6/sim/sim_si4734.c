@@ -0,0 +1,286 @@
+//sim_si4734.c
+//Model of the Si4734 radio at 0x22. A command is the bytes of one write and
+//runs when the write ends, on STOP or repeated START. CTS drops while it
+//runs and comes back after the time the datasheet gives for it. Commands
+//sent while CTS is low are dropped and counted. Reads return the status
+//byte followed by the response of the last command. Command times are the
+//datasheet maximums, counted from the end of the write, so a blind delay
+//counted from when the write was queued can come up short here.
+//
+//GPO2/INT is on INT7. It pulses when CTS comes back if CTSIEN is set
+//(POWER_UP ARG1 bit 7, or GPO_IEN bit 7) and when a tune finishes if
+//STCIEN is set (GPO_IEN bit 0).
+
+#include <string.h>
+#include "sim.h"
+
+#define SI_STATUS_CTS    0x80
+#define SI_STATUS_ERR    0x40
+#define SI_STATUS_RSQINT 0x08
+#define SI_STATUS_STCINT 0x01
+
+#define SI_GPO_IEN       0x0001 //property
+#define SI_HARD_MUTE     0x4001 //RX_HARD_MUTE
+#define SI_IEN_CTSIEN    0x0080
+#define SI_IEN_STCIEN    0x0001
+#define SI_SEEK_BOTTOM   0x1400 //FM_SEEK_BAND_BOTTOM
+#define SI_SEEK_TOP      0x1401 //FM_SEEK_BAND_TOP
+
+#define SI_SEEK_UP       0x08   //FM_SEEK_START ARG1
+#define SI_SEEK_WRAP     0x04
+#define SI_TUNE_BLTF     0x80   //FM_TUNE_STATUS RESP1
+
+#define SI_CMD_NS        300000ULL    //most commands
+#define SI_PWR_UP_NS     110000000ULL
+#define SI_PROPERTY_NS   10000000ULL
+#define SI_FM_TUNE_NS    60000000ULL  //CTS to STC
+#define SI_AM_TUNE_NS    80000000ULL
+#define SI_SEEK_NS       250000000ULL
+
+typedef struct {
+  uint16_t freq;  //10khz units for FM, khz for AM
+  uint8_t  rssi;  //dBuV
+} si_station_t;
+
+static const si_station_t si_fm_stations[] = {
+  {8870, 31}, {9110, 25}, {9450, 40}, {10630, 48}, {10790, 36}, {0, 0}
+};
+static const si_station_t si_am_stations[] = {
+  {550, 45}, {1190, 30}, {0, 0}
+};
+
+static uint8_t  si_cts = 1;
+static uint8_t  si_status;          //ERR, RSQINT, STCINT
+static uint8_t  si_powered;
+static uint8_t  si_am;              //powered up in AM mode
+static uint8_t  si_ctsien;
+static uint16_t si_gpo_ien;
+static uint16_t si_hard_mute;
+static uint16_t si_freq;
+static uint16_t si_seek_bottom = 8750;
+static uint16_t si_seek_top    = 10790;
+static uint8_t  si_bltf;            //last seek hit the band limit
+static uint8_t  si_cmd[8];
+static uint8_t  si_cmd_len;
+static uint8_t  si_writing;
+static uint8_t  si_resp[16];
+static uint8_t  si_rd_idx;
+static uint32_t si_dropped;
+
+uint32_t sim_si4734_dropped(void){return(si_dropped);}
+uint16_t sim_si4734_mute(void){return(si_hard_mute);}
+
+static uint8_t si_rssi(void){
+  const si_station_t *s = si_am ? si_am_stations : si_fm_stations;
+
+  for(; s->freq; s++){
+    if(s->freq == si_freq){return(s->rssi);}
+  }
+  return(8); //band noise
+}
+
+static void si_int(void){sim_raise_int7();}
+
+//******************************************************************************
+//                              timed events
+//
+static void si_cts_event(void){
+  si_cts = 1;
+  if(si_ctsien){si_int();}
+}
+
+static void si_stc_event(void){
+  si_status |= SI_STATUS_STCINT;
+  if(si_gpo_ien & SI_IEN_STCIEN){si_int();}
+}
+
+static void si_busy(uint64_t ns){
+  si_cts = 0;
+  sim_at(sim_now() + ns, si_cts_event);
+}
+
+//******************************************************************************
+//                              sim_si4734_reset
+//
+void sim_si4734_reset(void){
+  sim_cancel(si_cts_event);
+  sim_cancel(si_stc_event);
+  si_cts = 1; si_status = 0; si_powered = 0; si_am = 0;
+  si_ctsien = 0; si_gpo_ien = 0; si_freq = 0;
+  si_seek_bottom = 8750; si_seek_top = 10790; si_bltf = 0;
+  si_cmd_len = 0; si_writing = 0; si_rd_idx = 0; si_dropped = 0;
+  memset(si_resp, 0, sizeof(si_resp));
+}
+
+//******************************************************************************
+//                              si_tune_status
+//
+//FM_TUNE_STATUS and AM_TUNE_STATUS response.
+//
+static void si_tune_status(void){
+  uint8_t rssi = si_rssi();
+
+  if(si_cmd[1] & 0x01){si_status &= ~SI_STATUS_STCINT;} //INTACK
+  si_resp[1] = ((rssi >= 20) ? 0x01 : 0x00) |            //VALID
+               (si_bltf ? SI_TUNE_BLTF : 0x00);
+  si_resp[2] = (uint8_t)(si_freq >> 8);
+  si_resp[3] = (uint8_t)si_freq;
+  si_resp[4] = rssi;
+  si_resp[5] = rssi / 2;                                 //SNR
+  si_resp[6] = 0;
+  si_resp[7] = 0;
+}
+
+//******************************************************************************
+//                              si_rsq_status
+//
+static void si_rsq_status(void){
+  uint8_t rssi = si_rssi();
+
+  if(si_cmd[1] & 0x01){si_status &= ~SI_STATUS_RSQINT;}
+  si_resp[1] = 0;
+  si_resp[2] = (rssi >= 20) ? 0x01 : 0x00;
+  si_resp[3] = (!si_am && rssi >= 40) ? 0xE4 : 0x00;     //FM stereo pilot, blend
+  si_resp[4] = rssi;
+  si_resp[5] = rssi / 2;
+  si_resp[6] = 0;
+  si_resp[7] = 0;
+}
+
+//******************************************************************************
+//                              si_seek
+//
+//Moves to the next station in the table, up or down. FM seeks stay inside
+//the FM_SEEK_BAND properties. With no station left that way the seek wraps
+//around if ARG1 asks for it, otherwise it stops at the band limit with BLTF.
+//
+static void si_seek(uint8_t arg){
+  const si_station_t *s = si_am ? si_am_stations : si_fm_stations;
+  uint16_t best = 0, wrap = 0;
+  uint8_t  up = arg & SI_SEEK_UP;
+
+  si_bltf = 0;
+  for(; s->freq; s++){
+    if(!si_am && (s->freq < si_seek_bottom || s->freq > si_seek_top)){continue;}
+    if(up){
+      if(s->freq > si_freq && (!best || s->freq < best)){best = s->freq;}
+      if(!wrap || s->freq < wrap){wrap = s->freq;}
+    }
+    else{
+      if(s->freq < si_freq && s->freq > best){best = s->freq;}
+      if(s->freq > wrap){wrap = s->freq;}
+    }
+  }
+  if(best){si_freq = best; return;}
+  si_bltf = 1;
+  if((arg & SI_SEEK_WRAP) && wrap){si_freq = wrap;}
+  else if(!si_am){si_freq = up ? si_seek_top : si_seek_bottom;}
+}
+
+//******************************************************************************
+//                              si_run
+//
+//Executes the command just written.
+//
+static void si_run(void){
+  uint16_t prop, val;
+
+  if(!si_cts){si_dropped++; return;}
+  memset(si_resp, 0, sizeof(si_resp));
+  si_status &= ~SI_STATUS_ERR;
+  if(!si_powered && si_cmd[0] != 0x01 && si_cmd[0] != 0x10){
+    si_status |= SI_STATUS_ERR;
+    return;
+  }
+  switch(si_cmd[0]){
+    case 0x01: //POWER_UP
+      si_powered = 1;
+      si_am      = (si_cmd[1] & 0x0F) == 0x01;
+      si_ctsien  = (si_cmd[1] & 0x80) != 0;
+      si_gpo_ien   = 0;       //properties back to their defaults
+      si_hard_mute = 0;
+      si_busy(SI_PWR_UP_NS);
+      break;
+    case 0x10: //GET_REV
+      si_resp[1] = 34;  si_resp[2] = '6'; si_resp[3] = '0';
+      si_resp[6] = '2'; si_resp[7] = '0'; si_resp[8] = 'D';
+      si_busy(SI_CMD_NS);
+      break;
+    case 0x11: //POWER_DOWN
+      si_powered = 0;
+      si_busy(SI_CMD_NS);
+      break;
+    case 0x12: //SET_PROPERTY
+      prop = ((uint16_t)si_cmd[2] << 8) | si_cmd[3];
+      val  = ((uint16_t)si_cmd[4] << 8) | si_cmd[5];
+      if(prop == SI_GPO_IEN){
+        si_gpo_ien = val;
+        si_ctsien  = (val & SI_IEN_CTSIEN) != 0;
+      }
+      if(prop == SI_HARD_MUTE)  {si_hard_mute   = val;}
+      if(prop == SI_SEEK_BOTTOM){si_seek_bottom = val;}
+      if(prop == SI_SEEK_TOP)   {si_seek_top    = val;}
+      si_busy(SI_PROPERTY_NS);
+      break;
+    case 0x14: //GET_INT_STATUS
+      si_busy(SI_CMD_NS);
+      break;
+    case 0x20: //FM_TUNE_FREQ
+    case 0x40: //AM_TUNE_FREQ
+      si_freq = ((uint16_t)si_cmd[2] << 8) | si_cmd[3];
+      si_bltf = 0;
+      si_status &= ~SI_STATUS_STCINT;
+      si_busy(SI_CMD_NS);
+      sim_at(sim_now() + SI_CMD_NS + (si_am ? SI_AM_TUNE_NS : SI_FM_TUNE_NS), si_stc_event);
+      break;
+    case 0x21: //FM_SEEK_START
+    case 0x41: //AM_SEEK_START
+      si_seek(si_cmd[1]);
+      si_status &= ~SI_STATUS_STCINT;
+      si_busy(SI_CMD_NS);
+      sim_at(sim_now() + SI_CMD_NS + SI_SEEK_NS, si_stc_event);
+      break;
+    case 0x22: //FM_TUNE_STATUS
+    case 0x42: //AM_TUNE_STATUS
+      si_tune_status();
+      si_busy(SI_CMD_NS);
+      break;
+    case 0x23: //FM_RSQ_STATUS
+    case 0x43: //AM_RSQ_STATUS
+      si_rsq_status();
+      si_busy(SI_CMD_NS);
+      break;
+    default:
+      si_status |= SI_STATUS_ERR;
+  }
+}
+
+//******************************************************************************
+//                              bus side
+//
+static uint8_t si_start(uint8_t read){
+  si_writing = !read;
+  si_cmd_len = 0;
+  si_rd_idx  = 0;
+  return(1);
+}
+
+static uint8_t si_write(uint8_t byte){
+  if(si_cmd_len < sizeof(si_cmd)){si_cmd[si_cmd_len++] = byte;}
+  return(1);
+}
+
+static uint8_t si_read(void){
+  uint8_t idx = si_rd_idx++;
+
+  if(idx == 0){return((si_cts ? SI_STATUS_CTS : 0) | si_status);}
+  if(!si_cts || idx >= sizeof(si_resp)){return(0);}
+  return(si_resp[idx]);
+}
+
+static void si_stop(void){
+  if(si_writing && si_cmd_len){si_run();}
+  si_writing = 0;
+}
+
+sim_dev_t sim_si4734 = {"Si4734", 0x22, 0, si_start, si_write, si_read, si_stop, 0};
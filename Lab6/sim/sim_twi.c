@@ -0,0 +1,229 @@
+//sim_twi.c
+//Model of the mega128 TWI unit in master mode and the bus it drives.
+//
+//A write to TWCR with TWINT set starts the next bus action: START, STOP,
+//STOP then START, or one byte (SLA+RW or data). The action takes the bus
+//time it would at the rate set by TWBR, then TWSR (and TWDR for a read) is
+//loaded and TWINT is flagged to the interrupt system. Writing TWCR with
+//TWEN clear aborts whatever is on the bus, as it does on the chip.
+//
+//A device with hung set never finishes the byte it is addressed with or
+//given, like a slave stretching SCL forever. Aborting the TWI, which the
+//driver only does as part of its bus recovery, frees it again.
+
+#include <stddef.h>
+#include <avr/io.h>
+#include <util/twi.h>
+#include "sim.h"
+
+#define SIM_TWI_DEVS 4  //devices on the bus
+
+//where the master is in a transfer
+enum {SIM_BUS_IDLE, SIM_BUS_SLA, SIM_BUS_MT, SIM_BUS_MR, SIM_BUS_NONE};
+
+volatile uint8_t TWCR, TWSR, TWDR, TWBR, TWAR;
+volatile uint8_t PORTC, DDRC, PINC;
+volatile uint8_t PORTD, DDRD, PIND;
+volatile uint8_t PORTE, DDRE, PINE;
+volatile uint8_t EIMSK, EICRB;
+
+static sim_dev_t *sim_devs[SIM_TWI_DEVS];
+static sim_dev_t *sim_twi_dev;      //device addressed by the last SLA
+static uint8_t   sim_twi_state;     //SIM_BUS_*
+static uint8_t   sim_twi_enabled;   //TWEN as last seen
+static uint8_t   sim_twi_busy;      //a bus action is under way
+static uint8_t   sim_twi_owned;     //START sent, no STOP yet
+static uint64_t  sim_twi_since;     //when the bus was taken
+static uint64_t  sim_twi_free;      //when the last STOP is done
+static uint8_t   sim_twi_sr;        //TWSR when the action finishes
+static uint8_t   sim_twi_rx;        //TWDR when a read finishes
+static uint8_t   sim_twi_rd;        //the action is a read
+
+//******************************************************************************
+//                              sim_twi_bit_ns
+//
+//SCL period. The prescaler is taken as 1, as init_twi() sets it.
+//
+static uint64_t sim_twi_bit_ns(void){
+  return((16ULL + 2ULL * TWBR) * 1000000000ULL / SIM_F_CPU);
+}
+
+//******************************************************************************
+//                              sim_twi_attach
+//
+void sim_twi_attach(sim_dev_t *dev){
+  uint8_t i;
+
+  for(i = 0; i < SIM_TWI_DEVS; i++){
+    if(sim_devs[i] == NULL){sim_devs[i] = dev; return;}
+  }
+}
+
+static sim_dev_t *sim_twi_find(uint8_t sla){
+  uint8_t i;
+
+  for(i = 0; i < SIM_TWI_DEVS; i++){
+    if(sim_devs[i] && sim_devs[i]->addr == (sla & ~TW_READ)){return(sim_devs[i]);}
+  }
+  return(NULL);
+}
+
+//******************************************************************************
+//                              sim_twi_done
+//
+//End of a bus action, TWINT goes up.
+//
+static void sim_twi_done(void){
+  TWSR = sim_twi_sr;
+  if(sim_twi_rd){TWDR = sim_twi_rx;}
+  sim_twi_busy = 0;
+  sim_twi_flag();
+}
+
+static void sim_twi_finish(uint64_t when, uint8_t sr){
+  sim_twi_sr   = sr;
+  sim_twi_busy = 1;
+  sim_at(when, sim_twi_done);
+}
+
+//******************************************************************************
+//                              sim_twi_release
+//
+//Ends the device's part in the transfer, on a STOP or repeated START.
+//
+static void sim_twi_release(void){
+  if(sim_twi_dev && sim_twi_dev->stop){sim_twi_dev->stop();}
+  sim_twi_dev = NULL;
+}
+
+//******************************************************************************
+//                              sim_twi_reset
+//
+//TWEN cleared. Drops the transfer on the bus and frees a hung device.
+//
+void sim_twi_reset(void){
+  uint8_t i;
+
+  sim_cancel(sim_twi_done);
+  if(sim_twi_owned || sim_twi_busy){sim_stats.resets++;}
+  if(sim_twi_owned){sim_stats.bus_ns += sim_now() - sim_twi_since;}
+  sim_twi_dev     = NULL;
+  sim_twi_state   = SIM_BUS_IDLE;
+  sim_twi_busy    = 0;
+  sim_twi_owned   = 0;
+  sim_twi_enabled = 0;
+  for(i = 0; i < SIM_TWI_DEVS; i++){
+    if(sim_devs[i]){sim_devs[i]->hung = 0;}
+  }
+}
+
+//******************************************************************************
+//                              sim_twi_bus_free
+//
+uint8_t sim_twi_bus_free(void){
+  return(!sim_twi_owned && !sim_twi_busy && sim_twi_dev == NULL);
+}
+
+//******************************************************************************
+//                              sim_twi_byte
+//
+//Clocks one byte, SLA+RW or data, in the direction the transfer is in.
+//
+static void sim_twi_byte(uint64_t when, uint8_t ack_rx){
+  uint8_t sla, ack;
+
+  when += 9 * sim_twi_bit_ns();
+  sim_stats.bytes++;
+  sim_twi_rd = 0;
+
+  if(sim_twi_state == SIM_BUS_SLA){
+    sla = TWDR;
+    sim_twi_dev = sim_twi_find(sla);
+    if(sim_twi_dev && sim_twi_dev->hung){sim_stats.hangs++; sim_twi_busy = 1; return;}
+    ack = sim_twi_dev && sim_twi_dev->start(sla & TW_READ);
+    if(!ack){
+      sim_stats.nacks++;
+      sim_twi_dev   = NULL;
+      sim_twi_state = SIM_BUS_NONE;
+      sim_twi_finish(when, (sla & TW_READ) ? TW_MR_SLA_NACK : TW_MT_SLA_NACK);
+      return;
+    }
+    sim_twi_dev->bytes++;
+    sim_twi_state = (sla & TW_READ) ? SIM_BUS_MR : SIM_BUS_MT;
+    sim_twi_finish(when, (sla & TW_READ) ? TW_MR_SLA_ACK : TW_MT_SLA_ACK);
+    return;
+  }
+
+  if(sim_twi_state == SIM_BUS_NONE || sim_twi_dev == NULL){ //nobody listening
+    sim_stats.nacks++;
+    sim_twi_finish(when, TW_MT_DATA_NACK);
+    return;
+  }
+  if(sim_twi_dev->hung){sim_stats.hangs++; sim_twi_busy = 1; return;}
+  sim_twi_dev->bytes++;
+  if(sim_twi_state == SIM_BUS_MT){
+    ack = sim_twi_dev->write(TWDR);
+    if(!ack){sim_stats.nacks++;}
+    sim_twi_finish(when, ack ? TW_MT_DATA_ACK : TW_MT_DATA_NACK);
+  }
+  else{
+    sim_twi_rx = sim_twi_dev->read();
+    sim_twi_rd = 1;
+    sim_twi_finish(when, ack_rx ? TW_MR_DATA_ACK : TW_MR_DATA_NACK);
+  }
+}
+
+//******************************************************************************
+//                              sim_twi_poll
+//
+//Picks up a TWCR write. TWINT reads back clear once it has been taken.
+//
+void sim_twi_poll(void){
+  uint8_t  cmd = TWCR;
+  uint64_t when, bit;
+
+  if(!(cmd & (1<<TWEN))){ //TWI off, the pins are plain port pins again
+    if(sim_twi_enabled || sim_twi_busy || sim_twi_owned){sim_twi_reset();}
+    return;
+  }
+  sim_twi_enabled = 1;
+  if(!(cmd & (1<<TWINT))){return;}
+  TWCR = cmd & ~((1<<TWINT) | (1<<TWSTO));
+  if(sim_twi_busy){return;} //written too early, the chip ignores it too
+
+  bit  = sim_twi_bit_ns();
+  when = sim_now() + SIM_TWI_SW_NS;
+
+  if(cmd & (1<<TWSTO)){
+    if(sim_twi_owned){
+      when += bit;
+      sim_twi_release();
+      sim_stats.stops++;
+      sim_stats.bus_ns += when - sim_twi_since;
+      sim_twi_owned = 0;
+      sim_twi_free  = when;
+    }
+    sim_twi_state = SIM_BUS_IDLE;
+    if(!(cmd & (1<<TWSTA))){return;} //no interrupt after a STOP
+  }
+
+  if(cmd & (1<<TWSTA)){
+    sim_stats.starts++;
+    sim_twi_rd = 0;
+    if(sim_twi_owned){
+      sim_twi_release();
+      sim_twi_state = SIM_BUS_SLA;
+      sim_twi_finish(when + bit, TW_REP_START);
+    }
+    else{
+      if(when < sim_twi_free + bit){when = sim_twi_free + bit;} //bus free time
+      sim_twi_owned = 1;
+      sim_twi_since = when;
+      sim_twi_state = SIM_BUS_SLA;
+      sim_twi_finish(when + bit, TW_START);
+    }
+    return;
+  }
+
+  if(sim_twi_owned){sim_twi_byte(when, cmd & (1<<TWEA));}
+}
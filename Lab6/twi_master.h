@@ -5,9 +5,31 @@
 //using status codes in: usr/local/AVRMacPack/avr-3/include/util/twi.h
 //use my own defines for actions that are to be taken
 
+#ifndef TWI_MASTER_H
+#define TWI_MASTER_H
+
 #define TWI_TWBR 0x0C  //400khz TWI clock
 
+//Driver variant, chosen at build time (e.g. -DNO_INTERRUPTS=1 in DEFS).
+//At 0 transfers are queued and run by the TWI ISR while the caller goes on.
+//At 1 the TWI interrupt is not used: twi_post() and the twi_start_*()
+//calls poll TWINT and return once the transfer is over. That is cheaper
+//per byte than ISR entry and exit, but holds the CPU for the whole
+//transfer, and must not be used from an ISR. Only the chosen one is built.
+//
+//CPU cost at 16mhz, 400khz bus. These are estimates, not measurements: about
+//60 cycles of vector, prologue and epilogue per ISR entry against about 5 to
+//spot TWINT in the poll loop. The host sim in sim/ runs only the interrupt
+//driver, so it counts ISR entries and bus time but not cycles.
+//  LM73 read, wr_rd 1+2 bytes, 7 TWINT events:
+//    interrupt ~420 cycles, CPU free meanwhile
+//    polled    ~35 cycles, but held for ~115us of bus time (~1840 cycles)
+//  set_property, 6 byte write, 8 TWINT events:
+//    interrupt ~480 cycles, CPU free meanwhile
+//    polled    ~40 cycles, but held for ~160us of bus time (~2560 cycles)
+#ifndef NO_INTERRUPTS
 #define NO_INTERRUPTS  0
+#endif
 
 #if (NO_INTERRUPTS)
 
@@ -16,6 +38,8 @@
 #define TWCR_RACK   0xC4   //receive byte and return ack to slave  
 #define TWCR_RNACK  0x84   //receive byte and return nack to slave
 #define TWCR_SEND   0x84   //pokes the TWINT flag in TWCR and TWEN
+#define TWCR_RST    0x04   //reset TWI
+#define TWCR_STOP_START 0xB4 //send stop then start, chains the next queued xfer
 
 #else
 #define TWCR_START  0xA5 //send START 
@@ -24,16 +48,114 @@
 #define TWCR_RNACK  0x85 //receive byte and return NACK to slave
 #define TWCR_RST    0x04 //reset TWI
 #define TWCR_STOP   0x94 //send STOP,interrupt off, signals completion
+#define TWCR_STOP_START 0xB5 //send STOP then START, chains the next queued xfer
 
 #endif
 
 #define TWI_BUFFER_SIZE 17  //SLA+RW (1 byte) +  16 data bytes (message size)
 
-uint8_t twi_busy(void);
-void    twi_start_wr(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt);
-void    twi_start_rd(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt);
-void    init_twi();
+#define TWI_QUEUE_SIZE   8  //pending transfers, must be a power of two
 
+//Bus hang handling. twi_tick() is called from a periodic timer interrupt.
+//A transfer that makes no progress for TWI_TIMEOUT_TICKS ticks is aborted,
+//the bus is recovered by clocking SCL and sending a STOP, one edge per tick,
+//and the transfer is retried. NACKs and lost arbitration are retried the
+//same way. The polled driver times the transfer by counting TWINT polls
+//instead, and clocks the recovery out at once.
+#define TWI_TIMEOUT_TICKS 40 //40 x 128us (TIMER2_OVF) = 5ms without progress
+#define TWI_RECOVER_EDGES 22 //9 SCL clocks and a STOP, 22 x 128us = 2.8ms
+#define TWI_MAX_RETRIES   3  //retries per transfer before giving up on it
+#define TWI_POLL_TIMEOUT  8000 //TWINT polls without progress, ~5ms at 16mhz
 
+//pins used by the TWI unit, for bit-banged bus recovery
+#if defined(__AVR_ATmega48__) || defined(__AVR_ATmega88__) || defined(__AVR_ATmega168__)
+#define TWI_PORT    PORTC
+#define TWI_DDR     DDRC
+#define TWI_PIN     PINC
+#define TWI_SCL_BIT 5
+#define TWI_SDA_BIT 4
+#else //mega128
+#define TWI_PORT    PORTD
+#define TWI_DDR     DDRD
+#define TWI_PIN     PIND
+#define TWI_SCL_BIT 0
+#define TWI_SDA_BIT 1
+#endif
+
+//Transfer timing. With TWI_INSTRUMENT set to 1 (e.g. -DTWI_INSTRUMENT=1 in
+//DEFS) the ISR timestamps START, every data byte and STOP and keeps latency
+//stats per device address, see twi_instr_dump(). At 0 the hooks compile to
+//nothing. Timestamps come from a free running timer at clk/1. On the alarm
+//clock that is TCNT3, which counts 0 to OCR3A (0x2000), the volume PWM TOP,
+//so transfers longer than 512us read short. The Mega48 has no timer to spare for it, TIMER1 is
+//its one second clock at clk/1024 (lab5_atmega48.c), so there it is refused.
+#ifndef TWI_INSTRUMENT
+#define TWI_INSTRUMENT 0
+#endif
+
+#if TWI_INSTRUMENT
+#if defined(__AVR_ATmega48__) || defined(__AVR_ATmega88__) || defined(__AVR_ATmega168__)
+#error "TWI_INSTRUMENT needs a free running clk/1 timer, TIMER1 is the Mega48's 1s clock"
+#endif
+#define TWI_INSTR_DEVICES 4        //device addresses tracked
+#define TWI_TS_PER_US (F_CPU / 1000000UL)
+#define TWI_TIMESTAMP() TCNT3
+#define TWI_TS_TOP      0x2000 //OCR3A, the timer counts 0 to TOP
 
+//latency stats for one device, times in timer ticks
+typedef struct {
+  uint8_t  addr;    //SLA with R/W cleared, 0 if the slot is free
+  uint16_t count;   //transfers finished
+  uint16_t errors;  //transfers finished with TWI_XFER_ERROR
+  uint16_t lat_min; //START to STOP
+  uint16_t lat_max;
+  uint32_t lat_sum; //for the average
+  uint32_t bytes;   //bytes moved on the bus, SLA+RW included
+  uint16_t gap_max; //longest wait between two bus events
+} twi_instr_t;
+
+void twi_instr_dump(void (*put_str)(char *str));
+void twi_instr_reset(void);
+#endif
+
+//Per transfer status bits, written by the ISR into the caller's status byte.
+//The main loop can test these without touching the TWI registers.
+#define TWI_XFER_PENDING 0x01 //queued or on the bus
+#define TWI_XFER_DONE    0x02 //finished, buffers are free again
+#define TWI_XFER_ERROR   0x04 //finished but failed, see twi_error()
+
+//One queued transfer. The ISR works through these back to back, chaining
+//the START of the next one onto the STOP of the previous one.
+//A write with rd_cnt set is followed by a repeated START and a read.
+typedef struct {
+  uint8_t          addr;    //SLA+RW of the device
+  uint8_t          *buf;    //buffer we are xferred from/to
+  uint8_t          cnt;     //number of bytes to be xferred
+  uint8_t          *rd_buf; //buffer read into after a repeated START
+  uint8_t          rd_cnt;  //bytes to read after the write, zero for none
+  volatile uint8_t *status; //TWI_XFER_* bits for the caller, may be NULL
+} twi_xfer_t;
+
+//fault counters, see twi_get_stats()
+typedef struct {
+  uint16_t nacks;      //SLA or data byte not acknowledged
+  uint16_t arb_lost;   //arbitration lost to another master
+  uint16_t timeouts;   //transfers that stalled for TWI_TIMEOUT_TICKS
+  uint16_t recoveries; //SCL clock-out and STOP sequences sent
+  uint16_t failed;     //transfers dropped after TWI_MAX_RETRIES
+} twi_stats_t;
+
+uint8_t twi_busy(void);
+uint8_t twi_error(void);
+void    twi_tick(void);
+void    twi_flush(void);
+void    twi_get_stats(twi_stats_t *stats);
+uint8_t twi_post(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt,
+                 uint8_t *rd_data, uint8_t rd_cnt, volatile uint8_t *status);
+uint8_t twi_start_wr(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt);
+uint8_t twi_start_rd(uint8_t twi_addr, uint8_t *twi_data, uint8_t byte_cnt);
+uint8_t twi_start_wr_rd(uint8_t twi_addr, uint8_t *wr_data, uint8_t wr_cnt,
+                        uint8_t *rd_data, uint8_t rd_cnt);
+void    init_twi();
 
+#endif //TWI_MASTER_H
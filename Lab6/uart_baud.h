@@ -0,0 +1,34 @@
+//uart_baud.h
+//Compile time UBRR and U2X selection. The same file is used in Lab6 and
+//Lab5/Mega48, keep the copies identical.
+//
+//For a baud rate, UBRR is worked out rounded to nearest both for normal mode
+//(16 samples a bit) and for double speed mode (U2X, 8 samples a bit), and the
+//one that comes closer is used. Normal mode wins a tie, as it samples each
+//bit more and takes more clock drift. A USART source checks the result with
+//  #if BAUD_ERROR(rate) > BAUD_MAX_ERR
+//  #error ...
+//so a rate the clock can't make fails the build instead of the link.
+//At 16MHz 250k, 500k and 1M are exact, 115200 is not (3.5%, or 2.1% in U2X).
+
+#ifndef UART_BAUD_H
+#define UART_BAUD_H
+
+#define BAUD_MAX_ERR  20  //tenths of a percent
+
+#define UBRR_X16(baud)   (((F_CPU) + 8UL * (baud)) / (16UL * (baud)) - 1)
+#define UBRR_X8(baud)    (((F_CPU) + 4UL * (baud)) / (8UL * (baud)) - 1)
+#define BAUD_X16(baud)   ((F_CPU) / (16UL * (UBRR_X16(baud) + 1)))
+#define BAUD_X8(baud)    ((F_CPU) / (8UL * (UBRR_X8(baud) + 1)))
+
+//error of an actual rate from the one asked for, tenths of a percent
+#define BAUD_ERR(actual, baud) \
+  (((actual) > (baud) ? (actual) - (baud) : (baud) - (actual)) * 1000UL / (baud))
+
+#define BAUD_USE_U2X(baud) \
+  (BAUD_ERR(BAUD_X8(baud), baud) < BAUD_ERR(BAUD_X16(baud), baud))
+#define BAUD_UBRR(baud)  (BAUD_USE_U2X(baud) ? UBRR_X8(baud) : UBRR_X16(baud))
+#define BAUD_ERROR(baud) (BAUD_USE_U2X(baud) ? BAUD_ERR(BAUD_X8(baud), baud) \
+                                             : BAUD_ERR(BAUD_X16(baud), baud))
+
+#endif //UART_BAUD_H
@@ -5,16 +5,38 @@
 //they are located on.
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <stdlib.h>
 #include <avr/pgmspace.h>
+#include "uart_functions.h"
+#include "uart_baud.h"
 
 //F_CPU should be set in Makefile, don't set it here.
 
-#define USART_BAUDRATE 9600  
-#define BAUDVALUE  ((F_CPU/(USART_BAUDRATE * 16UL)) - 1 )
+//Rates can be overridden in DEFS. UBRR and U2X come from uart_baud.h.
+//USART0 is the link to the Mega48, which must use the same rate.
+#ifndef USART_BAUDRATE
+#define USART_BAUDRATE 38400
+#endif
+#ifndef USART1_BAUDRATE
+#define USART1_BAUDRATE 250000  //debug terminal, exact at 16MHz
+#endif
 
-#define USART1_BAUDRATE 9600  
-#define BAUDVALUE_1  ((F_CPU/(USART1_BAUDRATE * 16UL)) - 1 )
+#if BAUD_ERROR(USART_BAUDRATE) > BAUD_MAX_ERR
+#error "USART_BAUDRATE is more than 2% off at this F_CPU"
+#endif
+#if BAUD_ERROR(USART1_BAUDRATE) > BAUD_MAX_ERR
+#error "USART1_BAUDRATE is more than 2% off at this F_CPU"
+#endif
+#if BAUD_UBRR(USART_BAUDRATE) > 4095 || BAUD_UBRR(USART1_BAUDRATE) > 4095
+#error "baud rate too low for this F_CPU"
+#endif
+
+#define BAUDVALUE    BAUD_UBRR(USART_BAUDRATE)
+#define BAUD_U2X     BAUD_USE_U2X(USART_BAUDRATE)
+#define BAUDVALUE_1  BAUD_UBRR(USART1_BAUDRATE)
+#define BAUD_U2X_1   BAUD_USE_U2X(USART1_BAUDRATE)
 
 #include <string.h>
 
@@ -23,15 +45,196 @@ char uart_rx_buf[40];      //holds string that recieves data from uart
 
 char uart1_tx_buf[40];     //holds string to send to crt
 char uart1_rx_buf[40];     //holds string that recieves data from uart
+
+//transmit rings, filled by uart_write()/uart1_write() and emptied by the
+//data register empty ISRs. head is only moved by the writer, tail only by
+//the ISR.
+static volatile uint8_t uart_tx_ring[UART_TX_SIZE];
+static volatile uint8_t uart_tx_head, uart_tx_tail;
+static volatile uint8_t uart1_tx_ring[UART_TX_SIZE];
+static volatile uint8_t uart1_tx_head, uart1_tx_tail;
+
+//receive rings, filled by the receive complete ISRs and emptied by
+//uart_read()/uart1_read(). head is only moved by the ISR, tail only by
+//the reader, so neither side needs to lock out the other.
+static volatile uint8_t uart_rx_ring[UART_RX_SIZE];
+static volatile uint8_t uart_rx_head, uart_rx_tail;
+static volatile uint8_t uart1_rx_ring[UART_RX_SIZE];
+static volatile uint8_t uart1_rx_head, uart1_rx_tail;
+static uart_rx_stats_t  uart_rx_stats;
+static uart_rx_stats_t  uart1_rx_stats;
+
+//******************************************************************
+//                        uart_write
+//
+// Queues up to len bytes for USART0 and returns how many fit. Never
+// waits, so it may be called from an ISR, as long as main is not
+// writing USART0 too. The UDRE0 interrupt sends them.
+//
+uint8_t uart_write(const void *data, uint8_t len) {
+    const uint8_t *p = data;
+    uint8_t head = uart_tx_head;
+    uint8_t n;
+
+    for(n = 0; n < len; n++) {
+        if(((head + 1) & (UART_TX_SIZE - 1)) == uart_tx_tail) { break; } //full
+        uart_tx_ring[head] = p[n];
+        head = (head + 1) & (UART_TX_SIZE - 1);
+    }
+    uart_tx_head = head;
+    if(n) { UCSR0B |= (1<<UDRIE0); } //start, or keep, the ISR going
+    return(n);
+}
+//******************************************************************
+
+//******************************************************************
+//                        uart1_write
+//
+// Same as uart_write() for USART1.
+//
+uint8_t uart1_write(const void *data, uint8_t len) {
+    const uint8_t *p = data;
+    uint8_t head = uart1_tx_head;
+    uint8_t n;
+
+    for(n = 0; n < len; n++) {
+        if(((head + 1) & (UART_TX_SIZE - 1)) == uart1_tx_tail) { break; } //full
+        uart1_tx_ring[head] = p[n];
+        head = (head + 1) & (UART_TX_SIZE - 1);
+    }
+    uart1_tx_head = head;
+    if(n) { UCSR1B |= (1<<UDRIE1); }
+    return(n);
+}
+//******************************************************************
+
+//******************************************************************
+//                        USART0/1 data register empty ISRs
+//
+// Send the next queued byte, or turn themselves off once the ring is
+// empty. uart_write() turns them back on.
+//
+static inline __attribute__((always_inline)) void uart_tx_next() {
+    uint8_t tail = uart_tx_tail;
+
+    if(tail == uart_tx_head) { UCSR0B &= ~(1<<UDRIE0); return; }
+    UDR0 = uart_tx_ring[tail];
+    uart_tx_tail = (tail + 1) & (UART_TX_SIZE - 1);
+}
+
+static inline __attribute__((always_inline)) void uart1_tx_next() {
+    uint8_t tail = uart1_tx_tail;
+
+    if(tail == uart1_tx_head) { UCSR1B &= ~(1<<UDRIE1); return; }
+    UDR1 = uart1_tx_ring[tail];
+    uart1_tx_tail = (tail + 1) & (UART_TX_SIZE - 1);
+}
+
+ISR(USART0_UDRE_vect) { uart_tx_next(); }
+ISR(USART1_UDRE_vect) { uart1_tx_next(); }
+//******************************************************************
+
+//******************************************************************
+//                        USART0/1 receive complete ISRs
+//
+// Move the byte from UDRn into the receive ring. The error flags in
+// UCSRnA belong to the byte in UDRn, so they are read first. A byte
+// with a framing or parity error is counted and thrown away; an overrun
+// means bytes before this one were lost, this one is still good.
+//
+ISR(USART0_RX_vect) {
+    uint8_t status = UCSR0A;
+    uint8_t data = UDR0;
+    uint8_t head = uart_rx_head;
+    uint8_t next = (head + 1) & (UART_RX_SIZE - 1);
+
+    if(status & (1<<DOR0)) { uart_rx_stats.overruns++; }
+    if(status & (1<<FE0))  { uart_rx_stats.framing++; return; }
+    if(status & (1<<UPE0)) { uart_rx_stats.parity++;  return; }
+    if(next == uart_rx_tail) { uart_rx_stats.dropped++; return; } //reader is behind
+    uart_rx_ring[head] = data;
+    uart_rx_head = next;
+}
+
+ISR(USART1_RX_vect) {
+    uint8_t status = UCSR1A;
+    uint8_t data = UDR1;
+    uint8_t head = uart1_rx_head;
+    uint8_t next = (head + 1) & (UART_RX_SIZE - 1);
+
+    if(status & (1<<DOR1)) { uart1_rx_stats.overruns++; }
+    if(status & (1<<FE1))  { uart1_rx_stats.framing++; return; }
+    if(status & (1<<UPE1)) { uart1_rx_stats.parity++;  return; }
+    if(next == uart1_rx_tail) { uart1_rx_stats.dropped++; return; }
+    uart1_rx_ring[head] = data;
+    uart1_rx_head = next;
+}
+//******************************************************************
+
+//******************************************************************
+//                        uart_read
+//
+// Takes up to len received bytes from the USART0 ring and returns how
+// many there were. Never waits. One reader only.
+//
+uint8_t uart_read(void *data, uint8_t len) {
+    uint8_t *p = data;
+    uint8_t tail = uart_rx_tail;
+    uint8_t n;
+
+    for(n = 0; n < len && tail != uart_rx_head; n++) {
+        p[n] = uart_rx_ring[tail];
+        tail = (tail + 1) & (UART_RX_SIZE - 1);
+    }
+    uart_rx_tail = tail;
+    return(n);
+}
+//******************************************************************
+
+//******************************************************************
+//                        uart1_read
+//
+// Same as uart_read() for USART1.
+//
+uint8_t uart1_read(void *data, uint8_t len) {
+    uint8_t *p = data;
+    uint8_t tail = uart1_rx_tail;
+    uint8_t n;
+
+    for(n = 0; n < len && tail != uart1_rx_head; n++) {
+        p[n] = uart1_rx_ring[tail];
+        tail = (tail + 1) & (UART_RX_SIZE - 1);
+    }
+    uart1_rx_tail = tail;
+    return(n);
+}
+//******************************************************************
+
+//******************************************************************
+//                        uart_get_rx_stats, uart1_get_rx_stats
+//
+// Copy out the receive error counters.
+//
+void uart_get_rx_stats(uart_rx_stats_t *stats) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { *stats = uart_rx_stats; }
+}
+
+void uart1_get_rx_stats(uart_rx_stats_t *stats) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { *stats = uart1_rx_stats; }
+}
+//******************************************************************
+
 //******************************************************************
 //                        uart_putc
 //
-// Takes a character and sends it to USART0
+// Takes a character and sends it to USART0. Waits only while the
+// transmit ring is full. With interrupts off (called from an ISR) the
+// ring is drained here by polling, since the UDRE ISR cannot run.
 //
 void uart_putc(char data) {
-    while (!(UCSR0A&(1<<UDRE0)));    // Wait for previous transmissions
-    UDR0 = data;    // Send data byte
-    while (!(UCSR0A&(1<<UDRE0)));    // Wait for previous transmissions
+    while(!uart_write(&data, 1)) {
+        if(!(SREG & (1<<SREG_I)) && (UCSR0A & (1<<UDRE0))) { uart_tx_next(); }
+    }
 }
 //******************************************************************
 
@@ -41,9 +244,9 @@ void uart_putc(char data) {
 // Takes a character and sends it to USART1
 //
 void uart1_putc(char data) {
-    while (!(UCSR1A&(1<<UDRE1)));    // Wait for previous transmissions
-    UDR1 = data;    // Send data byte
-    while (!(UCSR1A&(1<<UDRE1)));    // Wait for previous transmissions
+    while(!uart1_write(&data, 1)) {
+        if(!(SREG & (1<<SREG_I)) && (UCSR1A & (1<<UDRE1))) { uart1_tx_next(); }
+    }
 }
 //******************************************************************
 
@@ -102,6 +305,7 @@ UCSR0B |= (1<<RXEN0) | (1<<TXEN0) | (1<<RXCIE0); //INTERRUPTS ENABLED
 
 //async operation, no parity,  one stop bit, 8-bit characters
   UCSR0C |= (1<<UCSZ01) | (1<<UCSZ00);
+  if(BAUD_U2X){UCSR0A |= (1<<U2X0);}  //double speed if it gets closer
   UBRR0H = (BAUDVALUE >>8 ); //load upper byte of the baud rate into UBRR 
   UBRR0L =  BAUDVALUE;       //load lower byte of the baud rate into UBRR 
 
@@ -118,11 +322,12 @@ UCSR0B |= (1<<RXEN0) | (1<<TXEN0) | (1<<RXCIE0); //INTERRUPTS ENABLED
 
 void uart1_init(){
 //rx and tx enable, receive interrupt enabled, 8 bit characters
-//UCSR1B |= (1<<RXEN1) | (1<<TXEN1) | (1<<RXCIE1); //INTERRUPTS ENABLED
-  UCSR1B |= (1<<RXEN1) | (1<<TXEN1);               //INTERRUPS DISABLED
+  UCSR1B |= (1<<RXEN1) | (1<<TXEN1) | (1<<RXCIE1); //INTERRUPTS ENABLED
+//UCSR1B |= (1<<RXEN1) | (1<<TXEN1);               //INTERRUPS DISABLED
 
 //async operation, no parity,  one stop bit, 8-bit characters
   UCSR1C |= (1<<UCSZ11) | (1<<UCSZ10);
+  if(BAUD_U2X_1){UCSR1A |= (1<<U2X1);}  //double speed if it gets closer
   UBRR1H = (BAUDVALUE_1 >>8 ); //load upper byte of the baud rate into UBRR 
   UBRR1L =  BAUDVALUE_1;       //load lower byte of the baud rate into UBRR 
 
@@ -131,39 +336,33 @@ void uart1_init(){
 
 //******************************************************************
 //                             uart_getc
-//Modified to not block indefinately in the case of a lost byte
+//Waits for a byte from the receive ring, giving up with 0 after about
+//16000 tries in the case of a lost byte. Not for use in an ISR.
 //
 char uart_getc(void) {
   uint16_t timer = 0;
+  char data;
 
-  while (!(UCSR0A & (1<<RXC0))) {
-  timer++;
-  if(timer >= 16000){ return(0);}
-  //what should we return if nothing comes in?
-  //return the data into a global variable
-  //give uart_getc the address of the variable
-  //return a -1 if no data comes back.
-  } // Wait for byte to arrive
-  return(UDR0); //return the received data
+  while(!uart_read(&data, 1)) {
+    timer++;
+    if(timer >= 16000){ return(0);}
+  }
+  return(data);
 }
 //******************************************************************
 
 //******************************************************************
 //                             uart1_getc
-//Modified to not block indefinately in the case of a lost byte
 //
 char uart1_getc(void) {
   uint16_t timer = 0;
+  char data;
 
-  while (!(UCSR1A & (1<<RXC1))) {
-  timer++;
-  if(timer >= 16000){ return(0);}
-  //what should we return if nothing comes in?
-  //return the data into a global variable
-  //give uart_getc the address of the variable
-  //return a -1 if no data comes back.
-  } // Wait for byte to arrive
-  return(UDR1); //return the received data
+  while(!uart1_read(&data, 1)) {
+    timer++;
+    if(timer >= 16000){ return(0);}
+  }
+  return(data);
 }
 //usage examples:
 //uart_puts(".");
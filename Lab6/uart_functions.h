@@ -3,6 +3,32 @@
 //For controlling the UART and sending debug data to a terminal
 //as an aid in debugging.
 
+#include <stdint.h>
+
+//Transmit is interrupt driven. uart_write()/uart1_write() queue bytes in a
+//ring of UART_TX_SIZE and return at once with how many were taken; the
+//UDRE ISRs send them. uart_putc()/uart_puts() and the uart1 ones are
+//blocking wrappers that wait only while the ring is full.
+#define UART_TX_SIZE 64  //bytes, must be a power of two
+
+//Receive is interrupt driven too. The receive complete ISRs put bytes in a
+//ring of UART_RX_SIZE that uart_read()/uart1_read() empty without waiting.
+//uart_getc()/uart1_getc() wait on it, with a timeout.
+#define UART_RX_SIZE 32  //bytes, must be a power of two
+
+typedef struct {
+  uint16_t overruns;  //DOR, bytes lost in the UART before the ISR ran
+  uint16_t framing;   //FE, bytes thrown away
+  uint16_t parity;    //UPE, bytes thrown away
+  uint16_t dropped;   //receive ring full
+} uart_rx_stats_t;
+
+uint8_t uart_write(const void *data, uint8_t len);
+uint8_t uart1_write(const void *data, uint8_t len);
+uint8_t uart_read(void *data, uint8_t len);
+uint8_t uart1_read(void *data, uint8_t len);
+void uart_get_rx_stats(uart_rx_stats_t *stats);
+void uart1_get_rx_stats(uart_rx_stats_t *stats);
 void uart_putc(char data);
 void uart_puts(char *str);
 void uart_puts_p(const char *str);
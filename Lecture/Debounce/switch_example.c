@@ -12,7 +12,7 @@
 #include <util/delay.h>
 #include <string.h>
 #include <stdlib.h>
-#include "lcd_functions.h"
+#include "hd44780.h"
 
 //#define DEBOUNCE
 
@@ -12,7 +12,7 @@
 #include <util/delay.h>
 #include <string.h>
 #include <stdlib.h>
-#include "lcd_functions.h"
+#include "hd44780.h"
 #include "lm73_functions_skel.h"
 #include "twi_master.h"
 
@@ -44,7 +44,7 @@ int main ()
 uint16_t lm73_temp;  //a place to assemble the temperature from the lm73
 
 spi_init();   //initalize SPI 
-lcd_init();   //initalize LCD (lcd_functions.h)
+lcd_init();   //initalize LCD (hd44780.h)
 init_twi();   //initalize TWI (twi_master.h)  
 
 //set LM73 mode for reading temperature by loading pointer register
@@ -67,6 +67,6 @@ while(1){          //main while loop
   lm73_temp |= lm73_rd_buf[1];  //"OR" in the low temp byte to lm73_temp 
   lm73_temp = lm73_temp >> 7;
   itoa(lm73_temp, lcd_string_array, 10); //convert to string in array with itoa() from avr-libc                           
-  string2lcd(lcd_string_array); //send the string to LCD (lcd_functions)
+  string2lcd(lcd_string_array); //send the string to LCD (hd44780)
   } //while
 } //main